@@ -0,0 +1,516 @@
+/*
+* Draw ordering for lots of instances.
+* Each instance gets a 64-bit sort key and the keys are sorted (carrying the instance index along) with an
+* LSD radix sort, 8 bits a pass, split over a pool of threads the sorter keeps for its lifetime. Bytes that
+* are the same in every key are skipped, so a scene with one layer and two programs only pays for the depth
+* bits. Draw in the sorted order and only change program/VAO when the key says they changed.
+*
+* Performance: the goal was 1M keys in a few ms, and that has NOT been shown. On the single core VM this was
+* written on, 1M blended keys (6 passes) take 35-70 ms depending on the run, 2-3x faster than
+* std::stable_sort. Nothing has been measured with more than one core, so how far the threads close that
+* gap is unknown.
+*
+* GpuRadixSorter is an optional compute shader version (needs GL 4.3) for keys that already live on the GPU.
+* Include after GL/glew.h. Needs C++14.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <iostream>
+
+namespace drawsort {
+
+//Depth gets 24 bits, quantised from [0, 1] where 0 is nearest
+inline uint32_t quantiseDepth(float depth) {
+    depth = depth < 0.0f ? 0.0f : depth > 1.0f ? 1.0f : depth;
+    return (uint32_t)(depth * 16777215.0f);
+}
+
+//Blended instances: layer | far-to-near depth | program | VAO, so each layer draws back to front and
+//instances at the same depth still group by state
+inline uint64_t blendedSortKey(uint8_t layer, float depth, uint16_t program, uint16_t vao) {
+    uint64_t backToFront = 16777215u - quantiseDepth(depth);
+    return (uint64_t)layer << 56 | backToFront << 32 | (uint64_t)program << 16 | vao;
+}
+
+//Opaque instances: layer | program | VAO | near-to-far depth, so state changes are as few as possible
+inline uint64_t materialSortKey(uint8_t layer, uint16_t program, uint16_t vao, float depth) {
+    return (uint64_t)layer << 56 | (uint64_t)program << 40 | (uint64_t)vao << 24 | quantiseDepth(depth);
+}
+
+//Get the program/VAO back out of a sorted key, blended says which of the two layouts built it
+inline uint16_t keyProgram(uint64_t key, bool blended) {
+    return (uint16_t)(blended ? key >> 16 : key >> 40);
+}
+
+inline uint16_t keyVAO(uint64_t key, bool blended) {
+    return (uint16_t)(blended ? key : key >> 24);
+}
+
+//Reusable barrier for the sorting threads (std::barrier is C++20)
+class Barrier {
+public:
+    explicit Barrier(int threads) : threads(threads), waiting(0), generation(0) {}
+
+    //Only while nobody is waiting
+    void reset(int threads) {
+        std::lock_guard<std::mutex> lock(mutex);
+        this->threads = threads;
+        waiting = 0;
+    }
+
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        int arrivedGeneration = generation;
+        if (++waiting == threads) {
+            waiting = 0;
+            generation++;
+            released.notify_all();
+        }
+        else {
+            released.wait(lock, [&] { return generation != arrivedGeneration; });
+        }
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable released;
+    int threads;
+    int waiting;
+    int generation;
+};
+
+//Keeps its scratch buffers and worker threads between calls, so sorting every frame doesn't start threads or,
+//once the buffers are big enough, allocate. One sort at a time per sorter
+class RadixSorter {
+public:
+    //Below this many keys per thread the threads cost more than they save
+    static const size_t MIN_KEYS_PER_THREAD = 65536;
+
+    explicit RadixSorter(unsigned int maxThreads = std::thread::hardware_concurrency())
+        : maxThreads(maxThreads > 0 ? maxThreads : 1), barrier(1) {
+        histograms.resize((size_t)this->maxThreads * 256);
+        differences.resize(this->maxThreads);
+        for (unsigned int thread = 1; thread < this->maxThreads; thread++) {
+            workers.emplace_back([this, thread] { workerLoop((int)thread); });
+        }
+    }
+
+    ~RadixSorter() {
+        {
+            std::lock_guard<std::mutex> lock(jobMutex);
+            stopping = true;
+        }
+        jobReady.notify_all();
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+    }
+
+    RadixSorter(const RadixSorter&) = delete;
+    RadixSorter& operator=(const RadixSorter&) = delete;
+
+    //Sorts keys ascending and applies the same moves to indices (stable, so equal keys keep their order)
+    void sort(std::vector<uint64_t>& keys, std::vector<uint32_t>& indices) {
+        size_t count = keys.size();
+        if (count < 2) {
+            return;
+        }
+        //Shrinking keeps the capacity, so this only allocates when count is bigger than it's been before
+        scratchKeys.resize(count);
+        scratchIndices.resize(count);
+
+        int threadCount = (int)std::min<size_t>(maxThreads, (count + MIN_KEYS_PER_THREAD - 1) / MIN_KEYS_PER_THREAD);
+        threadCount = threadCount > 0 ? threadCount : 1;
+        barrier.reset(threadCount);
+
+        //Hand the job to the first threadCount - 1 workers, do thread 0's share here, then wait for theirs
+        if (threadCount > 1) {
+            {
+                std::lock_guard<std::mutex> lock(jobMutex);
+                jobKeys = &keys;
+                jobIndices = &indices;
+                jobThreads = threadCount;
+                jobsRunning = threadCount - 1;
+                jobGeneration++;
+            }
+            jobReady.notify_all();
+        }
+        work(0, threadCount, keys, indices);
+        if (threadCount > 1) {
+            std::unique_lock<std::mutex> lock(jobMutex);
+            jobDone.wait(lock, [&] { return jobsRunning == 0; });
+        }
+
+        //An odd number of passes leaves the result in the scratch buffers (same size, so swapping is safe)
+        if (resultInScratch) {
+            keys.swap(scratchKeys);
+            indices.swap(scratchIndices);
+        }
+    }
+
+private:
+    void workerLoop(int thread) {
+        int seenGeneration = 0;
+        for (;;) {
+            std::unique_lock<std::mutex> lock(jobMutex);
+            jobReady.wait(lock, [&] { return stopping || jobGeneration != seenGeneration; });
+            if (stopping) {
+                return;
+            }
+            seenGeneration = jobGeneration;
+            int threadCount = jobThreads;
+            if (thread >= threadCount) {
+                continue;
+            }
+            lock.unlock();
+
+            work(thread, threadCount, *jobKeys, *jobIndices);
+
+            lock.lock();
+            if (--jobsRunning == 0) {
+                jobDone.notify_one();
+            }
+        }
+    }
+
+    void work(int thread, int threadCount, std::vector<uint64_t>& keys, std::vector<uint32_t>& indices) {
+        size_t count = keys.size();
+        size_t begin = count * thread / threadCount;
+        size_t end = count * (thread + 1) / threadCount;
+
+        //Find which bits differ from the first key anywhere, bytes with none set don't need a pass
+        uint64_t difference = 0;
+        for (size_t i = begin; i < end; i++) {
+            difference |= keys[i] ^ keys[0];
+        }
+        differences[thread] = difference;
+        barrier.wait();
+        difference = 0;
+        for (int t = 0; t < threadCount; t++) {
+            difference |= differences[t];
+        }
+
+        uint64_t* source = keys.data();
+        uint32_t* sourceIndices = indices.data();
+        uint64_t* destination = scratchKeys.data();
+        uint32_t* destinationIndices = scratchIndices.data();
+        bool inScratch = false;
+
+        for (int shift = 0; shift < 64; shift += 8) {
+            if (((difference >> shift) & 0xff) == 0) {
+                continue;
+            }
+
+            //Count this thread's digits
+            size_t* histogram = &histograms[(size_t)thread * 256];
+            std::fill(histogram, histogram + 256, 0);
+            for (size_t i = begin; i < end; i++) {
+                histogram[(source[i] >> shift) & 0xff]++;
+            }
+            barrier.wait();
+
+            //Where this thread writes each digit: after every smaller digit, then after earlier threads' copies of this one
+            size_t offsets[256];
+            size_t total = 0;
+            for (int digit = 0; digit < 256; digit++) {
+                for (int t = 0; t < threadCount; t++) {
+                    if (t == thread) {
+                        offsets[digit] = total;
+                    }
+                    total += histograms[(size_t)t * 256 + digit];
+                }
+            }
+            barrier.wait();
+
+            for (size_t i = begin; i < end; i++) {
+                size_t position = offsets[(source[i] >> shift) & 0xff]++;
+                destination[position] = source[i];
+                destinationIndices[position] = sourceIndices[i];
+            }
+            barrier.wait();
+
+            std::swap(source, destination);
+            std::swap(sourceIndices, destinationIndices);
+            inScratch = !inScratch;
+        }
+
+        if (thread == 0) {
+            resultInScratch = inScratch;
+        }
+    }
+
+    unsigned int maxThreads;
+    std::vector<uint64_t> scratchKeys;
+    std::vector<uint32_t> scratchIndices;
+    std::vector<size_t> histograms;
+    std::vector<uint64_t> differences;
+    bool resultInScratch = false;
+
+    //Worker pool, the job fields are only touched under jobMutex or while the job is running
+    Barrier barrier;
+    std::vector<std::thread> workers;
+    std::mutex jobMutex;
+    std::condition_variable jobReady, jobDone;
+    std::vector<uint64_t>* jobKeys = NULL;
+    std::vector<uint32_t>* jobIndices = NULL;
+    int jobThreads = 0;
+    int jobsRunning = 0;
+    int jobGeneration = 0;
+    bool stopping = false;
+};
+
+//Compute shader version: 4 bits a pass, keys stored as two uints (low word first, which is how a
+//uint64_t array looks in memory anyway). Each pass counts digits per block of BLOCK_SIZE keys, scans
+//the counts in one workgroup, then scatters every block in order so the sort stays stable
+const char* const radixHistogramShaderSource = R"glsl(
+    #version 430 core
+    layout (local_size_x = 256) in;
+    layout (std430, binding = 0) readonly buffer Keys { uvec2 keys[]; };
+    layout (std430, binding = 2) writeonly buffer BlockCounts { uint blockCounts[]; };
+    uniform uint count;
+    uniform uint shift;
+    uniform uint blockCount;
+    shared uint counts[16];
+
+    void main() {
+        if (gl_LocalInvocationID.x < 16u) {
+            counts[gl_LocalInvocationID.x] = 0u;
+        }
+        barrier();
+        uint blockStart = gl_WorkGroupID.x * 1024u;
+        for (uint i = 0u; i < 4u; i++) {
+            uint index = blockStart + i * 256u + gl_LocalInvocationID.x;
+            if (index < count) {
+                uvec2 key = keys[index];
+                uint digit = ((shift < 32u ? key.x >> shift : key.y >> (shift - 32u))) & 15u;
+                atomicAdd(counts[digit], 1u);
+            }
+        }
+        barrier();
+        if (gl_LocalInvocationID.x < 16u) {
+            blockCounts[gl_LocalInvocationID.x * blockCount + gl_WorkGroupID.x] = counts[gl_LocalInvocationID.x];
+        }
+    }
+)glsl";
+
+//Exclusive scan over all the block counts (digit major), so each entry becomes where that block's digit starts
+const char* const radixScanShaderSource = R"glsl(
+    #version 430 core
+    layout (local_size_x = 1024) in;
+    layout (std430, binding = 2) buffer BlockCounts { uint blockCounts[]; };
+    uniform uint total;
+    shared uint sums[1024];
+
+    void main() {
+        uint thread = gl_LocalInvocationID.x;
+        uint perThread = (total + 1023u) / 1024u;
+        uint begin = min(thread * perThread, total);
+        uint end = min(begin + perThread, total);
+
+        uint sum = 0u;
+        for (uint i = begin; i < end; i++) {
+            sum += blockCounts[i];
+        }
+        sums[thread] = sum;
+        barrier();
+
+        for (uint step = 1u; step < 1024u; step <<= 1u) {
+            uint add = thread >= step ? sums[thread - step] : 0u;
+            barrier();
+            sums[thread] += add;
+            barrier();
+        }
+
+        uint running = sums[thread] - sum;
+        for (uint i = begin; i < end; i++) {
+            uint value = blockCounts[i];
+            blockCounts[i] = running;
+            running += value;
+        }
+    }
+)glsl";
+
+const char* const radixScatterShaderSource = R"glsl(
+    #version 430 core
+    layout (local_size_x = 256) in;
+    layout (std430, binding = 0) readonly buffer Keys { uvec2 keys[]; };
+    layout (std430, binding = 1) readonly buffer Values { uint values[]; };
+    layout (std430, binding = 2) readonly buffer BlockCounts { uint blockCounts[]; };
+    layout (std430, binding = 3) writeonly buffer OutKeys { uvec2 outKeys[]; };
+    layout (std430, binding = 4) writeonly buffer OutValues { uint outValues[]; };
+    uniform uint count;
+    uniform uint shift;
+    uniform uint blockCount;
+    shared uint digits[256];
+    shared uint bases[16];
+
+    void main() {
+        uint thread = gl_LocalInvocationID.x;
+        if (thread < 16u) {
+            bases[thread] = blockCounts[thread * blockCount + gl_WorkGroupID.x];
+        }
+
+        //Four rounds of 256 keys in order, each key's place is the digit's base plus how many
+        //earlier keys in the round had the same digit
+        uint blockStart = gl_WorkGroupID.x * 1024u;
+        for (uint round = 0u; round < 4u; round++) {
+            uint index = blockStart + round * 256u + thread;
+            uvec2 key = uvec2(0u);
+            uint digit = 16u;
+            if (index < count) {
+                key = keys[index];
+                digit = ((shift < 32u ? key.x >> shift : key.y >> (shift - 32u))) & 15u;
+            }
+            digits[thread] = digit;
+            barrier();
+
+            if (digit < 16u) {
+                uint rank = 0u;
+                for (uint i = 0u; i < thread; i++) {
+                    rank += digits[i] == digit ? 1u : 0u;
+                }
+                uint position = bases[digit] + rank;
+                outKeys[position] = key;
+                outValues[position] = values[index];
+            }
+            barrier();
+
+            if (digit < 16u) {
+                atomicAdd(bases[digit], 1u);
+            }
+            barrier();
+        }
+    }
+)glsl";
+
+class GpuRadixSorter {
+public:
+    static const GLuint BLOCK_SIZE = 1024;
+
+    //Returns false if compute shaders aren't available or didn't build
+    bool init() {
+        if (!GLEW_VERSION_4_3 && !GLEW_ARB_compute_shader) {
+            return false;
+        }
+        histogramProgram = createComputeProgram(radixHistogramShaderSource);
+        scanProgram = createComputeProgram(radixScanShaderSource);
+        scatterProgram = createComputeProgram(radixScatterShaderSource);
+        glGenBuffers(3, buffers);
+        return histogramProgram && scanProgram && scatterProgram;
+    }
+
+    //Sorts count keys (two uints each) in keyBuffer and the matching uint values in valueBuffer in place,
+    //ready for any use once it returns (no barrier needed). Scratch buffers only grow, like the CPU version's.
+    //varyingBits can skip passes like the CPU version's byte check, pass ~0 if you don't know.
+    //The scan runs in a single workgroup, so count can go up to about 1024 * 1024 * 64 keys
+    void sort(GLuint keyBuffer, GLuint valueBuffer, GLuint count, uint64_t varyingBits = ~0ull) {
+        if (count < 2) {
+            return;
+        }
+        GLuint blockCount = (count + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        if (count > capacity) {
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[0]);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, (GLsizeiptr)count * 2 * sizeof(GLuint), NULL, GL_DYNAMIC_COPY);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[1]);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, (GLsizeiptr)count * sizeof(GLuint), NULL, GL_DYNAMIC_COPY);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[2]);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, (GLsizeiptr)blockCount * 16 * sizeof(GLuint), NULL, GL_DYNAMIC_COPY);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+            capacity = count;
+        }
+
+        GLuint sourceKeys = keyBuffer, sourceValues = valueBuffer;
+        GLuint destinationKeys = buffers[0], destinationValues = buffers[1];
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, buffers[2]);
+
+        for (GLuint shift = 0; shift < 64; shift += 4) {
+            if (((varyingBits >> shift) & 15) == 0) {
+                continue;
+            }
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, sourceKeys);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, sourceValues);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, destinationKeys);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, destinationValues);
+
+            glUseProgram(histogramProgram);
+            glUniform1ui(glGetUniformLocation(histogramProgram, "count"), count);
+            glUniform1ui(glGetUniformLocation(histogramProgram, "shift"), shift);
+            glUniform1ui(glGetUniformLocation(histogramProgram, "blockCount"), blockCount);
+            glDispatchCompute(blockCount, 1, 1);
+            glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+            glUseProgram(scanProgram);
+            glUniform1ui(glGetUniformLocation(scanProgram, "total"), blockCount * 16);
+            glDispatchCompute(1, 1, 1);
+            glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+            glUseProgram(scatterProgram);
+            glUniform1ui(glGetUniformLocation(scatterProgram, "count"), count);
+            glUniform1ui(glGetUniformLocation(scatterProgram, "shift"), shift);
+            glUniform1ui(glGetUniformLocation(scatterProgram, "blockCount"), blockCount);
+            glDispatchCompute(blockCount, 1, 1);
+            glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+            std::swap(sourceKeys, destinationKeys);
+            std::swap(sourceValues, destinationValues);
+        }
+
+        //The result may be read back, drawn from or used by another shader, so make the last pass's writes
+        //visible to all of those (the copy below is an ordinary GL command, its writes need no barrier)
+        glMemoryBarrier(GL_ALL_BARRIER_BITS);
+
+        //Odd number of passes, copy the result back where the caller expects it
+        if (sourceKeys != keyBuffer) {
+            glBindBuffer(GL_COPY_READ_BUFFER, sourceKeys);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, keyBuffer);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, (GLsizeiptr)count * 2 * sizeof(GLuint));
+            glBindBuffer(GL_COPY_READ_BUFFER, sourceValues);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, valueBuffer);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, (GLsizeiptr)count * sizeof(GLuint));
+        }
+    }
+
+    void destroy() {
+        glDeleteProgram(histogramProgram);
+        glDeleteProgram(scanProgram);
+        glDeleteProgram(scatterProgram);
+        glDeleteBuffers(3, buffers);
+        capacity = 0;
+    }
+
+private:
+    static GLuint createComputeProgram(const char* source) {
+        GLuint shader = glCreateShader(GL_COMPUTE_SHADER);
+        glShaderSource(shader, 1, &source, NULL);
+        glCompileShader(shader);
+        GLuint program = glCreateProgram();
+        glAttachShader(program, shader);
+        glLinkProgram(program);
+        glDeleteShader(shader);
+
+        GLint linked = GL_FALSE;
+        glGetProgramiv(program, GL_LINK_STATUS, &linked);
+        if (!linked) {
+            char log[1024];
+            glGetProgramInfoLog(program, sizeof(log), NULL, log);
+            std::cerr << log << std::endl;
+            glDeleteProgram(program);
+            return 0;
+        }
+        return program;
+    }
+
+    GLuint histogramProgram = 0, scanProgram = 0, scatterProgram = 0;
+    GLuint buffers[3] = { 0, 0, 0 }; //scratch keys, scratch values, block counts
+    GLuint capacity = 0;
+};
+
+}
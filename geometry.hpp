@@ -0,0 +1,183 @@
+/*
+* Compile time geometry and transforms for the triangle programs.
+* Meshes are built with constexpr functions so the vertices end up baked into the binary instead of
+* being worked out with sqrt() every time the program starts. TransformPipeline builds the MVP for
+* only the parts of the transform that are switched on, the rest gets constant folded away.
+* Needs C++14 (loops inside constexpr functions).
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cmath>
+
+namespace geometry {
+
+constexpr double PI = 3.14159265358979323846;
+
+//Square root that works at compile time (std::sqrt isn't constexpr), Newton's method from above
+constexpr double constSqrt(double x) {
+    if (x <= 0.0) {
+        return 0.0;
+    }
+    double root = x > 1.0 ? x : 1.0;
+    for (int i = 0; i < 128; i++) {
+        double next = 0.5 * (root + x / root);
+        if (next >= root) {
+            break;
+        }
+        root = next;
+    }
+    return root;
+}
+
+//Sine that works at compile time: wrap into [-pi, pi] then a Taylor series
+constexpr double constSin(double x) {
+    while (x > PI) {
+        x -= 2.0 * PI;
+    }
+    while (x < -PI) {
+        x += 2.0 * PI;
+    }
+    double term = x;
+    double sum = x;
+    for (int n = 1; n < 16; n++) {
+        term *= -x * x / ((2.0 * n) * (2.0 * n + 1.0));
+        sum += term;
+    }
+    return sum;
+}
+
+constexpr double constCos(double x) {
+    return constSin(x + PI / 2.0);
+}
+
+constexpr float SQRT3 = (float)constSqrt(3.0);
+
+//Circumradius of an equilateral triangle with sides of 1
+constexpr float UNIT_TRIANGLE_RADIUS = (float)(1.0 / constSqrt(3.0));
+
+//Triangle list, x y z per vertex and every three vertices make a triangle
+template <size_t VertexCount>
+struct Mesh {
+    float vertices[VertexCount * 3];
+
+    static constexpr size_t vertexCount = VertexCount;
+    static constexpr size_t triangleCount = VertexCount / 3;
+};
+
+//Regular polygon around the origin as a fan of Sides - 2 triangles, counter-clockwise starting at startAngle
+//(the default puts a corner straight up, which for 3 sides is the triangle the programs draw)
+template <size_t Sides>
+constexpr Mesh<(Sides - 2) * 3> regularPolygon(float radius, double startAngle = PI / 2.0) {
+    static_assert(Sides >= 3, "a polygon needs at least 3 sides");
+    Mesh<(Sides - 2) * 3> mesh{};
+    for (size_t i = 0; i < Sides - 2; i++) {
+        const size_t corners[3] = { 0, i + 1, i + 2 };
+        for (size_t j = 0; j < 3; j++) {
+            double angle = startAngle + 2.0 * PI * corners[j] / Sides;
+            mesh.vertices[(i * 3 + j) * 3 + 0] = (float)(radius * constCos(angle));
+            mesh.vertices[(i * 3 + j) * 3 + 1] = (float)(radius * constSin(angle));
+            mesh.vertices[(i * 3 + j) * 3 + 2] = 0.0f;
+        }
+    }
+    return mesh;
+}
+
+//Stretches a mesh along x and y
+template <size_t N>
+constexpr Mesh<N> scaleMesh(const Mesh<N>& mesh, float scaleX, float scaleY) {
+    Mesh<N> scaled{};
+    for (size_t i = 0; i < N; i++) {
+        scaled.vertices[i * 3 + 0] = mesh.vertices[i * 3 + 0] * scaleX;
+        scaled.vertices[i * 3 + 1] = mesh.vertices[i * 3 + 1] * scaleY;
+        scaled.vertices[i * 3 + 2] = mesh.vertices[i * 3 + 2];
+    }
+    return scaled;
+}
+
+//Splits every triangle into four through the midpoints of its edges, keeping the winding
+template <size_t N>
+constexpr Mesh<N * 4> subdivideOnce(const Mesh<N>& mesh) {
+    Mesh<N * 4> out{};
+    for (size_t t = 0; t < N / 3; t++) {
+        float corner[3][3] = {};
+        float middle[3][3] = {};
+        for (size_t v = 0; v < 3; v++) {
+            for (size_t axis = 0; axis < 3; axis++) {
+                corner[v][axis] = mesh.vertices[(t * 3 + v) * 3 + axis];
+            }
+        }
+        for (size_t v = 0; v < 3; v++) {
+            for (size_t axis = 0; axis < 3; axis++) {
+                middle[v][axis] = 0.5f * (corner[v][axis] + corner[(v + 1) % 3][axis]);
+            }
+        }
+
+        //a, ab, ca | ab, b, bc | ca, bc, c | ab, bc, ca
+        const float* triangles[4][3] = {
+            { corner[0], middle[0], middle[2] },
+            { middle[0], corner[1], middle[1] },
+            { middle[2], middle[1], corner[2] },
+            { middle[0], middle[1], middle[2] }
+        };
+        for (size_t i = 0; i < 4; i++) {
+            for (size_t v = 0; v < 3; v++) {
+                for (size_t axis = 0; axis < 3; axis++) {
+                    out.vertices[((t * 4 + i) * 3 + v) * 3 + axis] = triangles[i][v][axis];
+                }
+            }
+        }
+    }
+    return out;
+}
+
+template <int Levels>
+struct Subdivider {
+    template <size_t N>
+    static constexpr Mesh<(N << (2 * Levels))> apply(const Mesh<N>& mesh) {
+        return Subdivider<Levels - 1>::apply(subdivideOnce(mesh));
+    }
+};
+
+template <>
+struct Subdivider<0> {
+    template <size_t N>
+    static constexpr Mesh<N> apply(const Mesh<N>& mesh) {
+        return mesh;
+    }
+};
+
+//Subdivides Levels times, so every triangle becomes 4^Levels of them
+template <int Levels, size_t N>
+constexpr Mesh<(N << (2 * Levels))> subdivide(const Mesh<N>& mesh) {
+    return Subdivider<Levels>::apply(mesh);
+}
+
+//Column major 4x4, the layout glUniformMatrix4fv (and glm) expects
+struct Mat4 {
+    float m[16];
+};
+
+//translation * rotation * scale written straight into the result instead of three generic 4x4s and two
+//multiplies. Rotation goes the same way as triangle_final_final.cpp (clockwise for positive theta).
+//The template flags are constants so whatever is switched off costs nothing, e.g. a translate only
+//pipeline never calls cos/sin
+template <bool Translate, bool Rotate, bool Scale>
+struct TransformPipeline {
+    static inline Mat4 compose(float offsetX, float offsetY, float theta, float scale) {
+        float c = Rotate ? std::cos(theta) : 1.0f;
+        float s = Rotate ? std::sin(theta) : 0.0f;
+        float k = Scale ? scale : 1.0f;
+        float x = Translate ? offsetX : 0.0f;
+        float y = Translate ? offsetY : 0.0f;
+        return Mat4{ {
+            c * k,  -s * k, 0.0f, 0.0f,
+            s * k,  c * k,  0.0f, 0.0f,
+            0.0f,   0.0f,   1.0f, 0.0f,
+            x,      y,      0.0f, 1.0f
+        } };
+    }
+};
+
+}
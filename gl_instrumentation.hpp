@@ -0,0 +1,234 @@
+/*
+* Debug instrumentation for the triangle programs:
+*  - a KHR_debug message callback that prints whatever the driver complains about
+*  - named GPU timer scopes using GL_TIME_ELAPSED, collected once the GPU has finished them instead of stalling
+*  - matching CPU scopes
+*  - export of both as a Chrome trace (open it in chrome://tracing or ui.perfetto.dev)
+*
+* Only use the PROFILE_ and GL_CHECK macros. It's off unless GL_INSTRUMENTATION is defined as 1 (e.g.
+* -DGL_INSTRUMENTATION=1 for a debug build), otherwise the macros expand to nothing and none of this exists.
+* Include after GL/glew.h. Scope names must be string literals, only the pointer is kept.
+* GL_TIME_ELAPSED queries can't overlap, so nested GPU scopes are ignored and only the outermost one is timed,
+* and a GPU scope must not wrap code that runs its own GL_TIME_ELAPSED query.
+*/
+
+#pragma once
+
+#ifndef GL_INSTRUMENTATION
+#define GL_INSTRUMENTATION 0
+#endif
+
+#if GL_INSTRUMENTATION
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <chrono>
+
+namespace instrumentation {
+
+//Caps memory use on long runs, later events are dropped
+const size_t MAX_TRACE_EVENTS = 1000000;
+
+enum Track {
+    CPU_TRACK = 1,
+    GPU_TRACK = 2
+};
+
+struct TraceEvent {
+    const char* name;
+    int track;
+    double startUs;
+    double durationUs;
+};
+
+struct PendingGpuScope {
+    const char* name;
+    GLuint query;
+    double submitUs;
+};
+
+struct State {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::vector<TraceEvent> events;
+    std::vector<TraceEvent> cpuStack;
+    std::vector<GLuint> freeQueries;
+    std::vector<PendingGpuScope> gpuScopes;
+    int gpuDepth = 0;
+};
+
+inline State& state() {
+    static State instance;
+    return instance;
+}
+
+inline double nowUs() {
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - state().start).count();
+}
+
+inline void record(const TraceEvent& event) {
+    if (state().events.size() < MAX_TRACE_EVENTS) {
+        state().events.push_back(event);
+    }
+}
+
+//Notifications are just chatter about buffer placement and such, everything else gets printed
+static void APIENTRY debugMessage(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar* message, const void* userParam)
+{
+    if (severity == GL_DEBUG_SEVERITY_NOTIFICATION) {
+        return;
+    }
+    const char* level = severity == GL_DEBUG_SEVERITY_HIGH ? "high" : severity == GL_DEBUG_SEVERITY_MEDIUM ? "medium" : "low";
+    std::cout << "GL debug (" << level << ", id " << id << "): " << message << std::endl;
+}
+
+//Call once after glewInit. Synchronous output so the callback runs inside the call that caused it
+inline void init() {
+    state().start = std::chrono::steady_clock::now();
+    if (GLEW_KHR_debug || GLEW_VERSION_4_3) {
+        glEnable(GL_DEBUG_OUTPUT);
+        glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+        glDebugMessageCallback(&debugMessage, NULL);
+    }
+    else {
+        std::cout << "KHR_debug not available, GL debug messages are off" << std::endl;
+    }
+}
+
+inline void cpuBegin(const char* name) {
+    state().cpuStack.push_back({ name, CPU_TRACK, nowUs(), 0.0 });
+}
+
+inline void cpuEnd() {
+    if (state().cpuStack.empty()) {
+        return;
+    }
+    TraceEvent event = state().cpuStack.back();
+    state().cpuStack.pop_back();
+    event.durationUs = nowUs() - event.startUs;
+    record(event);
+}
+
+inline void gpuBegin(const char* name) {
+    if (state().gpuDepth++ > 0) {
+        return;
+    }
+    std::vector<GLuint>& pool = state().freeQueries;
+    if (pool.empty()) {
+        GLuint query;
+        glGenQueries(1, &query);
+        pool.push_back(query);
+    }
+    PendingGpuScope scope = { name, pool.back(), nowUs() };
+    pool.pop_back();
+    state().gpuScopes.push_back(scope);
+    glBeginQuery(GL_TIME_ELAPSED, scope.query);
+}
+
+inline void gpuEnd() {
+    if (state().gpuDepth > 0 && --state().gpuDepth == 0) {
+        glEndQuery(GL_TIME_ELAPSED);
+    }
+}
+
+//Call once per frame after swapping. Collects the GPU scopes the GPU has finished and frees up their queries,
+//the rest are checked again next frame, so the profiler never waits on the GPU. GPU events are placed at the
+//time they were submitted on the CPU timeline, their durations are the real GPU time
+inline void endFrame() {
+    if (state().gpuDepth > 0) {
+        return;
+    }
+    std::vector<PendingGpuScope>& scopes = state().gpuScopes;
+    size_t kept = 0;
+    for (const PendingGpuScope& scope : scopes) {
+        GLint available = GL_FALSE;
+        glGetQueryObjectiv(scope.query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) {
+            scopes[kept++] = scope;
+            continue;
+        }
+        GLuint64 elapsedNs = 0;
+        glGetQueryObjectui64v(scope.query, GL_QUERY_RESULT, &elapsedNs);
+        record({ scope.name, GPU_TRACK, scope.submitUs, elapsedNs / 1000.0 });
+        state().freeQueries.push_back(scope.query);
+    }
+    scopes.resize(kept);
+}
+
+//Writes everything recorded so far in the Chrome trace event format
+inline void writeTrace(const char* path) {
+    std::ofstream file(path);
+    file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    file << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << CPU_TRACK << ", \"args\": {\"name\": \"CPU\"}},\n";
+    file << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << GPU_TRACK << ", \"args\": {\"name\": \"GPU\"}}";
+    for (const TraceEvent& event : state().events) {
+        file << ",\n{\"name\": \"" << event.name << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << event.track
+            << ", \"ts\": " << event.startUs << ", \"dur\": " << event.durationUs << "}";
+    }
+    file << "\n]}\n";
+    std::cout << "Wrote " << state().events.size() << " trace events to " << path << std::endl;
+}
+
+//Call before the context goes away, frees the pooled queries
+inline void shutdown() {
+    std::vector<GLuint>& pool = state().freeQueries;
+    for (const PendingGpuScope& scope : state().gpuScopes) {
+        pool.push_back(scope.query);
+    }
+    if (!pool.empty()) {
+        glDeleteQueries((GLsizei)pool.size(), pool.data());
+    }
+    pool.clear();
+    state().gpuScopes.clear();
+    state().gpuDepth = 0;
+}
+
+inline void checkError(const char* file, int line) {
+    for (GLenum error = glGetError(); error != GL_NO_ERROR; error = glGetError()) {
+        std::cout << "GL error 0x" << std::hex << error << std::dec << " at " << file << ":" << line << std::endl;
+    }
+}
+
+//RAII versions for when the scope matches a C++ block
+struct CpuScope {
+    CpuScope(const char* name) { cpuBegin(name); }
+    ~CpuScope() { cpuEnd(); }
+};
+
+struct GpuScope {
+    GpuScope(const char* name) { gpuBegin(name); }
+    ~GpuScope() { gpuEnd(); }
+};
+
+}
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+
+#define PROFILE_INIT() instrumentation::init()
+#define PROFILE_CPU_BEGIN(name) instrumentation::cpuBegin(name)
+#define PROFILE_CPU_END() instrumentation::cpuEnd()
+#define PROFILE_GPU_BEGIN(name) instrumentation::gpuBegin(name)
+#define PROFILE_GPU_END() instrumentation::gpuEnd()
+#define PROFILE_CPU_SCOPE(name) instrumentation::CpuScope PROFILE_CONCAT(cpuScope, __LINE__)(name)
+#define PROFILE_GPU_SCOPE(name) instrumentation::GpuScope PROFILE_CONCAT(gpuScope, __LINE__)(name)
+#define PROFILE_END_FRAME() instrumentation::endFrame()
+#define PROFILE_WRITE_TRACE(path) instrumentation::writeTrace(path)
+#define PROFILE_SHUTDOWN() instrumentation::shutdown()
+#define GL_CHECK() instrumentation::checkError(__FILE__, __LINE__)
+
+#else
+
+#define PROFILE_INIT() ((void)0)
+#define PROFILE_CPU_BEGIN(name) ((void)0)
+#define PROFILE_CPU_END() ((void)0)
+#define PROFILE_GPU_BEGIN(name) ((void)0)
+#define PROFILE_GPU_END() ((void)0)
+#define PROFILE_CPU_SCOPE(name) ((void)0)
+#define PROFILE_GPU_SCOPE(name) ((void)0)
+#define PROFILE_END_FRAME() ((void)0)
+#define PROFILE_WRITE_TRACE(path) ((void)0)
+#define PROFILE_SHUTDOWN() ((void)0)
+#define GL_CHECK() ((void)0)
+
+#endif
@@ -32,6 +32,15 @@ static void glfwError(int id, const char* description)
     std::cout << description << std::endl;
 }
 
+//Set when the window needs repainting (first show, uncovered, resized...)
+static bool windowDirty = true;
+
+//Window refresh callback function
+static void windowRefresh(GLFWwindow* window)
+{
+    windowDirty = true;
+}
+
 int main()
 {
     //Setting error callback function
@@ -55,9 +64,15 @@ int main()
         return -2;
     }
     glfwMakeContextCurrent(window);
+    glfwSetWindowRefreshCallback(window, &windowRefresh);
 
     //Start up glew, must be done after making the current context or things break
     GLenum err = glewInit();
+    if (err != GLEW_OK) {
+        std::cout << "glewInit failed: " << glewGetErrorString(err) << std::endl;
+        glfwTerminate();
+        return -3;
+    }
 
     //Vertices of the triangle
     GLfloat vertices[]{
@@ -111,18 +126,22 @@ int main()
     glfwSwapBuffers(window); //Important to swap buffers after a change so the window actually updates
 
     //Main render loop
+    //The triangle never changes, so only redraw when the window asks for it and otherwise sleep until the next event
     while (!glfwWindowShouldClose(window)) {
-        //Refreshing background colour
-        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
-        glClear(GL_COLOR_BUFFER_BIT);
-
-        glUseProgram(shaderProgram);
-        glBindVertexArray(VAO);
-        glDrawArrays(GL_TRIANGLES, 0, 3);
-        glfwSwapBuffers(window);
-
-        //Handles events
-        glfwPollEvents();
+        if (windowDirty) {
+            //Refreshing background colour
+            glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+            glClear(GL_COLOR_BUFFER_BIT);
+
+            glUseProgram(shaderProgram);
+            glBindVertexArray(VAO);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+            glfwSwapBuffers(window);
+            windowDirty = false;
+        }
+
+        //Handles events, waiting for one instead of spinning
+        glfwWaitEvents();
     }
 
     //Cleanup
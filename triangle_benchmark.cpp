@@ -0,0 +1,882 @@
+/*
+* Headless benchmark for the triangle renderer.
+* Sweeps instance counts (1 to 1M) over a few ways of submitting the same triangles and prints JSON
+* with frame time percentiles, draw calls and bytes uploaded per frame. Give it a baseline (an old
+* --out file) and it flags every case whose median frame got slower than the threshold allows and exits
+* with 1. Each case runs --repeats times and reports the median of those runs. It also has to be at least
+* --min-delta-ms slower, so timer noise on tiny cases doesn't count, and p99 only gets a warning since
+* with 60 frames it's close to the single slowest one.
+*
+* It also times building the MVPs on the CPU, generic glm matrices against geometry::TransformPipeline,
+* draws across two programs and two shapes in instance order against radix sorted orders (see
+* draw_sort.hpp), and the sort on its own on the CPU and with compute shaders.
+*
+*   triangle_benchmark [--frames N] [--repeats N] [--max-instances N] [--per-object-max N]
+*                      [--out results.json] [--baseline baseline.json] [--threshold-p50 0.10]
+*                      [--threshold-p99 0.25] [--min-delta-ms 0.5]
+*
+* Runs in a hidden window, so LIBGL_ALWAYS_SOFTWARE=1 works for machines without a GPU.
+* Results only mean something against the same renderer, so a baseline from a different one (it's written
+* into the JSON) is refused, as is a baseline that can't be read.
+*/
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+#include <cmath>
+#include "GL/glew.h"
+#include "GLFW/glfw3.h"
+#include "glm.hpp"
+#include "mat4x4.hpp"
+#include "ext/matrix_transform.hpp"
+#include "geometry.hpp"
+#include "draw_sort.hpp"
+
+//Window dimensions
+#define HEIGHT 800
+#define WIDTH 800
+
+#define TRIANGLE_HEIGHT 0.1f
+#define TRIANGLE_WIDTH 0.1f
+
+//Vertices of the (equilateral) triangle, generated at compile time
+constexpr geometry::Mesh<3> triangleMesh = geometry::scaleMesh(geometry::regularPolygon<3>(geometry::UNIT_TRIANGLE_RADIUS), TRIANGLE_WIDTH, TRIANGLE_HEIGHT);
+
+//Second shape for the ordered draw cases so there is a VAO to switch between
+constexpr geometry::Mesh<6> squareMesh = geometry::scaleMesh(geometry::regularPolygon<4>(geometry::UNIT_TRIANGLE_RADIUS, geometry::PI / 4.0), TRIANGLE_WIDTH, TRIANGLE_HEIGHT);
+
+//Defaults for the command line options
+#define DEFAULT_FRAMES 60
+#define DEFAULT_REPEATS 3 //Whole sweeps, each case reports the median of them
+#define WARMUP_FRAMES 5
+#define DEFAULT_MAX_INSTANCES 1000000
+#define DEFAULT_PER_OBJECT_MAX 100000 //One draw call per triangle gets painfully slow past this
+#define DEFAULT_THRESHOLD_P50 0.10 //Allowed slowdown before a case counts as a regression
+#define DEFAULT_THRESHOLD_P99 0.25 //Slowdown that gets a warning
+#define DEFAULT_MIN_DELTA_MS 0.5 //Anything closer than this to the baseline is noise
+#define MIN_TRANSFORM_BUILDS 100000LL //Matrices built per timing sample in the transform cases
+
+//Same shaders as triangle_final_final.cpp, used for one draw call per triangle
+const char* vertexShaderSource = R"glsl(
+    #version 330 core
+    layout (location = 0) in vec3 MSpos;
+    uniform mat4 MVP;
+
+    void main() {
+        vec4 v = vec4(MSpos,1);
+        gl_Position = MVP * v;
+    }
+)glsl";
+
+const char* fragmentShaderSource = R"glsl(
+    #version 330 core
+    out vec4 FragColour;
+    uniform vec4 vertexColour;
+
+    void main()
+    {
+        FragColour = vertexColour;
+    }
+)glsl";
+
+//Second material for the ordered draw cases, washed out version of the colour
+const char* tintedFragmentShaderSource = R"glsl(
+    #version 330 core
+    out vec4 FragColour;
+    uniform vec4 vertexColour;
+
+    void main()
+    {
+        FragColour = vec4(vertexColour.rgb * 0.5 + 0.5, vertexColour.a);
+    }
+)glsl";
+
+//Instanced version: offsetX, offsetY, theta and scale come in per instance and the
+//rotate/scale/translate from the MVP is done by hand (same rotation direction as the CPU matrix)
+const char* instancedVertexShaderSource = R"glsl(
+    #version 330 core
+    layout (location = 0) in vec3 MSpos;
+    layout (location = 1) in vec4 transform;
+    layout (location = 2) in vec4 colour;
+    out vec4 instanceColour;
+
+    void main() {
+        float c = cos(transform.z);
+        float s = sin(transform.z);
+        vec2 p = MSpos.xy * transform.w;
+        gl_Position = vec4(c * p.x + s * p.y + transform.x, -s * p.x + c * p.y + transform.y, MSpos.z, 1.0);
+        instanceColour = colour;
+    }
+)glsl";
+
+const char* instancedFragmentShaderSource = R"glsl(
+    #version 330 core
+    in vec4 instanceColour;
+    out vec4 FragColour;
+
+    void main()
+    {
+        FragColour = instanceColour;
+    }
+)glsl";
+
+//Per instance data, matches the layout the instanced shader reads
+struct Instance {
+    float offsetX, offsetY, theta, scale;
+    float r, g, b, a;
+};
+
+//Layout glMultiDrawArraysIndirect expects for each command
+struct DrawArraysIndirectCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint first;
+    GLuint baseInstance;
+};
+
+enum Strategy {
+    PER_OBJECT, //glUniform + glDrawArrays for every triangle, what the triangle programs do today
+    INSTANCED,  //one glDrawArraysInstanced with the transforms in an instance buffer
+    INDIRECT,   //one glMultiDrawArraysIndirect with a command per triangle (baseInstance picks the data)
+    STRATEGY_COUNT
+};
+
+const char* strategyNames[STRATEGY_COUNT] = { "per_object", "instanced", "indirect" };
+
+//Orders for the runOrderedCase draws
+enum DrawOrder {
+    UNSORTED,      //blended, in the order the instances were made
+    BACK_TO_FRONT, //blended, sorted by drawsort::blendedSortKey
+    BY_MATERIAL,   //opaque, sorted by drawsort::materialSortKey
+    DRAW_ORDER_COUNT
+};
+
+const char* drawOrderNames[DRAW_ORDER_COUNT] = { "draw_unsorted", "draw_back_to_front", "draw_by_material" };
+
+struct Result {
+    std::string strategy;
+    long long instances;
+    double p50, p90, p99, max;
+    long long drawCalls;
+    long long bytesUploaded;
+    long long stateChanges = 0; //glUseProgram + glBindVertexArray calls a frame, only counted by runOrderedCase
+};
+
+//What runOrderedCase sorts by, on top of the Instance
+struct Material {
+    uint8_t layer;
+    uint16_t program; //index into the programs passed to runOrderedCase
+    uint16_t vao;     //same for the VAOs
+    float depth;
+};
+
+//Error callback function
+static void glfwError(int id, const char* description)
+{
+    std::cout << description << std::endl;
+}
+
+//Compiles and links a vertex + fragment shader pair, printing the info log if something goes wrong
+GLuint createProgram(const char* vertexSource, const char* fragmentSource) {
+    GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
+    glShaderSource(vertexShader, 1, &vertexSource, NULL);
+    glCompileShader(vertexShader);
+
+    GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+    glShaderSource(fragmentShader, 1, &fragmentSource, NULL);
+    glCompileShader(fragmentShader);
+
+    GLuint program = glCreateProgram();
+    glAttachShader(program, vertexShader);
+    glAttachShader(program, fragmentShader);
+    glLinkProgram(program);
+
+    GLint linked = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if (!linked) {
+        char log[1024];
+        glGetProgramInfoLog(program, sizeof(log), NULL, log);
+        std::cerr << log << std::endl;
+    }
+
+    glDeleteShader(vertexShader);
+    glDeleteShader(fragmentShader);
+    return program;
+}
+
+//Nearest-rank percentile of an already sorted list
+double percentile(const std::vector<double>& sorted, double p) {
+    size_t index = (size_t)std::ceil(p * sorted.size());
+    return sorted[index > 0 ? index - 1 : 0];
+}
+
+//Sorts the frame times and fills in the percentiles
+void summarise(Result& result, std::vector<double>& frameTimes) {
+    std::sort(frameTimes.begin(), frameTimes.end());
+    result.p50 = percentile(frameTimes, 0.50);
+    result.p90 = percentile(frameTimes, 0.90);
+    result.p99 = percentile(frameTimes, 0.99);
+    result.max = frameTimes.back();
+}
+
+//Combines repeated runs of the same sweep (same cases in the same order), every timing becomes the median of that case's runs
+std::vector<Result> medianOfRounds(const std::vector<std::vector<Result>>& rounds) {
+    std::vector<Result> results = rounds[0];
+    double Result::* timings[4] = { &Result::p50, &Result::p90, &Result::p99, &Result::max };
+    for (size_t i = 0; i < results.size(); i++) {
+        for (double Result::* timing : timings) {
+            std::vector<double> values;
+            for (const std::vector<Result>& round : rounds) {
+                values.push_back(round[i].*timing);
+            }
+            std::sort(values.begin(), values.end());
+            results[i].*timing = percentile(values, 0.5);
+        }
+    }
+    return results;
+}
+
+//The generic way triangle_final_final.cpp used to build its MVP: three full 4x4s and two multiplies
+glm::mat4x4 genericMVP(float offsetX, float offsetY, float theta, float scale) {
+    glm::mat4x4 rotation_matrix = glm::mat4x4(
+        glm::vec4(cos(theta),   -sin(theta),    0.0f, 0.0f),
+        glm::vec4(sin(theta),   cos(theta),     0.0f, 0.0f),
+        glm::vec4(0.0f,         0.0f,           1.0f, 0.0f),
+        glm::vec4(0.0f,         0.0f,           0.0f, 1.0f)
+    );
+
+    glm::mat4x4 scaling_matrix = glm::mat4x4(
+        glm::vec4(scale,    0.0f,   0.0f, 0.0f),
+        glm::vec4(0.0f,     scale,  0.0f, 0.0f),
+        glm::vec4(0.0f,     0.0f,   1.0f, 0.0f),
+        glm::vec4(0.0f,     0.0f,   0.0f, 1.0f)
+    );
+
+    glm::mat4x4 translation_matrix = glm::mat4x4(
+        glm::vec4(1.0f,     0.0f,       0.0f, 0.0f),
+        glm::vec4(0.0f,     1.0f,       0.0f, 0.0f),
+        glm::vec4(0.0f,     0.0f,       1.0f, 0.0f),
+        glm::vec4(offsetX,  offsetY,    0.0f, 1.0f)
+    );
+
+    return translation_matrix * rotation_matrix * scaling_matrix;
+}
+
+//Scatters the instances over the screen with a spread of sizes, angles and colours
+void fillInstances(std::vector<Instance>& instances) {
+    unsigned int seed = 1234567u;
+    auto random = [&seed]() {
+        seed = seed * 1664525u + 1013904223u;
+        return (seed >> 8) / 16777216.0f;
+    };
+    for (Instance& instance : instances) {
+        instance.offsetX = random() * 1.8f - 0.9f;
+        instance.offsetY = random() * 1.8f - 0.9f;
+        instance.theta = random() * 6.2831853f;
+        instance.scale = 0.05f + random() * 0.15f;
+        instance.r = random();
+        instance.g = random();
+        instance.b = random();
+        instance.a = 1.0f;
+    }
+}
+
+//Renders `frames` frames of `count` spinning triangles with one strategy and times each frame.
+//glFinish at the end of a frame makes the time cover the GPU work too, not just submission.
+Result runCase(GLFWwindow* window, Strategy strategy, long long count, int frames,
+    GLuint shaderProgram, GLuint instancedProgram, GLuint VAO, GLuint instanceVAO, GLuint instanceVBO, GLuint indirectBuffer) {
+    std::vector<Instance> instances((size_t)count);
+    fillInstances(instances);
+
+    if (strategy == INDIRECT) {
+        //Commands never change, so they're uploaded once here and don't count towards per frame uploads
+        std::vector<DrawArraysIndirectCommand> commands((size_t)count);
+        for (long long i = 0; i < count; i++) {
+            commands[(size_t)i] = { 3, 1, 0, (GLuint)i };
+        }
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+        glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(DrawArraysIndirectCommand), commands.data(), GL_STATIC_DRAW);
+    }
+    if (strategy != PER_OBJECT) {
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(Instance), NULL, GL_STREAM_DRAW);
+    }
+
+    GLint MatrixID = glGetUniformLocation(shaderProgram, "MVP");
+    GLint ColourID = glGetUniformLocation(shaderProgram, "vertexColour");
+
+    Result result = { strategyNames[strategy], count, 0.0, 0.0, 0.0, 0.0, 0, 0 };
+    std::vector<double> frameTimes;
+    for (int frame = 0; frame < frames + WARMUP_FRAMES; frame++) {
+        auto start = std::chrono::steady_clock::now();
+        long long drawCalls = 0;
+        long long bytesUploaded = 0;
+
+        glClear(GL_COLOR_BUFFER_BIT);
+
+        //Everything spins a little each frame so the data really has to be sent again
+        for (Instance& instance : instances) {
+            instance.theta += 0.01f;
+        }
+
+        if (strategy == PER_OBJECT) {
+            glUseProgram(shaderProgram);
+            glBindVertexArray(VAO);
+            for (const Instance& instance : instances) {
+                glm::mat4x4 MVP = genericMVP(instance.offsetX, instance.offsetY, instance.theta, instance.scale);
+                glUniformMatrix4fv(MatrixID, 1, GL_FALSE, &MVP[0][0]);
+                glUniform4f(ColourID, instance.r, instance.g, instance.b, instance.a);
+                glDrawArrays(GL_TRIANGLES, 0, 3);
+            }
+            drawCalls = count;
+            bytesUploaded = count * (sizeof(glm::mat4x4) + 4 * sizeof(float));
+        }
+        else {
+            //Orphan the old storage so the driver doesn't wait for last frame to finish with it
+            glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+            glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(Instance), NULL, GL_STREAM_DRAW);
+            glBufferSubData(GL_ARRAY_BUFFER, 0, instances.size() * sizeof(Instance), instances.data());
+            bytesUploaded = count * sizeof(Instance);
+
+            glUseProgram(instancedProgram);
+            glBindVertexArray(instanceVAO);
+            if (strategy == INSTANCED) {
+                glDrawArraysInstanced(GL_TRIANGLES, 0, 3, (GLsizei)count);
+            }
+            else {
+                glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+                glMultiDrawArraysIndirect(GL_TRIANGLES, (void*)0, (GLsizei)count, 0);
+            }
+            drawCalls = 1;
+        }
+
+        glfwSwapBuffers(window);
+        glFinish();
+        glfwPollEvents();
+
+        double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if (frame >= WARMUP_FRAMES) {
+            frameTimes.push_back(milliseconds);
+        }
+        result.drawCalls = drawCalls;
+        result.bytesUploaded = bytesUploaded;
+    }
+
+    summarise(result, frameTimes);
+    return result;
+}
+
+//CPU only: builds `count` MVPs a frame into one array (as if they were about to be uploaded) with
+//buildMatrix(instance, out) writing the 16 floats, so the matrix paths can be compared on their own.
+//A few matrices take well under a microsecond, too short to time, so each sample repeats the frame's
+//builds until it has done at least MIN_TRANSFORM_BUILDS and reports the time of one frame's worth
+template <typename BuildMatrix>
+Result runTransformCase(const char* name, long long count, int frames, BuildMatrix buildMatrix) {
+    std::vector<Instance> instances((size_t)count);
+    fillInstances(instances);
+    std::vector<float> matrices((size_t)count * 16);
+    long long repeats = std::max(1LL, MIN_TRANSFORM_BUILDS / count);
+
+    Result result = { name, count, 0.0, 0.0, 0.0, 0.0, 0, 0 };
+    std::vector<double> frameTimes;
+    for (int frame = 0; frame < frames + WARMUP_FRAMES; frame++) {
+        auto start = std::chrono::steady_clock::now();
+        for (long long repeat = 0; repeat < repeats; repeat++) {
+            for (size_t i = 0; i < instances.size(); i++) {
+                instances[i].theta += 0.01f;
+                buildMatrix(instances[i], &matrices[i * 16]);
+            }
+        }
+        double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / repeats;
+        if (frame >= WARMUP_FRAMES) {
+            frameTimes.push_back(milliseconds);
+        }
+    }
+
+    //Use the output so none of the work can be optimised out
+    volatile float checksum = 0.0f;
+    for (float value : matrices) {
+        checksum = checksum + value;
+    }
+
+    summarise(result, frameTimes);
+    return result;
+}
+
+//Triangles and squares with two different programs, drawn one at a time in one of the DrawOrders.
+//Depths drift every frame so the keys are rebuilt and sorted every frame like they would be in a real
+//scene, and that time counts. Program and VAO only get bound when they change, so stateChanges shows
+//what sorting saves (back to front can't save much, depth has to come first for blending to be right)
+Result runOrderedCase(GLFWwindow* window, DrawOrder drawOrder, long long count, int frames,
+    const GLuint programs[2], const GLuint VAOs[2], drawsort::RadixSorter& sorter) {
+    std::vector<Instance> instances((size_t)count);
+    fillInstances(instances);
+    std::vector<Material> materials((size_t)count);
+    for (size_t i = 0; i < materials.size(); i++) {
+        unsigned int hash = (unsigned int)i * 2654435761u;
+        instances[i].a = drawOrder == BY_MATERIAL ? 1.0f : 0.5f;
+        materials[i] = { (uint8_t)(i % 8 == 0 ? 1 : 0), (uint16_t)(hash >> 31), (uint16_t)((hash >> 30) & 1), (instances[i].offsetY + 0.9f) / 1.8f };
+    }
+    const GLsizei vertexCounts[2] = { (GLsizei)triangleMesh.vertexCount, (GLsizei)squareMesh.vertexCount };
+    GLint MatrixIDs[2], ColourIDs[2];
+    for (int i = 0; i < 2; i++) {
+        MatrixIDs[i] = glGetUniformLocation(programs[i], "MVP");
+        ColourIDs[i] = glGetUniformLocation(programs[i], "vertexColour");
+    }
+
+    std::vector<uint64_t> keys((size_t)count);
+    std::vector<uint32_t> order((size_t)count);
+
+    if (drawOrder != BY_MATERIAL) {
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    }
+
+    Result result = { drawOrderNames[drawOrder], count, 0.0, 0.0, 0.0, 0.0, 0, 0 };
+    std::vector<double> frameTimes;
+    for (int frame = 0; frame < frames + WARMUP_FRAMES; frame++) {
+        auto start = std::chrono::steady_clock::now();
+        glClear(GL_COLOR_BUFFER_BIT);
+
+        for (size_t i = 0; i < instances.size(); i++) {
+            instances[i].theta += 0.01f;
+            materials[i].depth = std::fmod(materials[i].depth + 0.001f, 1.0f);
+            order[i] = (uint32_t)i;
+        }
+        if (drawOrder != UNSORTED) {
+            for (size_t i = 0; i < materials.size(); i++) {
+                const Material& material = materials[i];
+                keys[i] = drawOrder == BACK_TO_FRONT
+                    ? drawsort::blendedSortKey(material.layer, material.depth, material.program, material.vao)
+                    : drawsort::materialSortKey(material.layer, material.program, material.vao, material.depth);
+            }
+            sorter.sort(keys, order);
+        }
+
+        //0 is never one of our programs or VAOs, so the first draw always binds both
+        GLuint currentProgram = 0, currentVAO = 0;
+        long long stateChanges = 0;
+        //Sorted orders read the state straight out of the key, there are no keys to read in instance order
+        bool blended = drawOrder != BY_MATERIAL;
+        for (size_t i = 0; i < order.size(); i++) {
+            const Instance& instance = instances[order[i]];
+            uint16_t program = drawOrder == UNSORTED ? materials[order[i]].program : drawsort::keyProgram(keys[i], blended);
+            uint16_t vao = drawOrder == UNSORTED ? materials[order[i]].vao : drawsort::keyVAO(keys[i], blended);
+            if (programs[program] != currentProgram) {
+                currentProgram = programs[program];
+                glUseProgram(currentProgram);
+                stateChanges++;
+            }
+            if (VAOs[vao] != currentVAO) {
+                currentVAO = VAOs[vao];
+                glBindVertexArray(currentVAO);
+                stateChanges++;
+            }
+            geometry::Mat4 MVP = geometry::TransformPipeline<true, true, true>::compose(instance.offsetX, instance.offsetY, instance.theta, instance.scale);
+            glUniformMatrix4fv(MatrixIDs[program], 1, GL_FALSE, MVP.m);
+            glUniform4f(ColourIDs[program], instance.r, instance.g, instance.b, instance.a);
+            glDrawArrays(GL_TRIANGLES, 0, vertexCounts[vao]);
+        }
+
+        glfwSwapBuffers(window);
+        glFinish();
+        glfwPollEvents();
+
+        double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if (frame >= WARMUP_FRAMES) {
+            frameTimes.push_back(milliseconds);
+        }
+        result.drawCalls = count;
+        result.bytesUploaded = count * (sizeof(geometry::Mat4) + 4 * sizeof(float));
+        result.stateChanges = stateChanges;
+    }
+
+    glDisable(GL_BLEND);
+    summarise(result, frameTimes);
+    return result;
+}
+
+//Times sorting `count` blended sort keys (with their indices) on their own, on the CPU or, if gpuSorter
+//isn't NULL, with compute shaders. Building the keys and uploading them aren't timed, the GPU time
+//includes a glFinish. Checks the last frame's result is actually in order
+Result runSortCase(long long count, int frames, drawsort::RadixSorter& sorter, drawsort::GpuRadixSorter* gpuSorter) {
+    std::vector<Instance> instances((size_t)count);
+    fillInstances(instances);
+    std::vector<uint64_t> keys((size_t)count);
+    std::vector<uint32_t> indices((size_t)count);
+
+    GLuint buffers[2] = { 0, 0 };
+    if (gpuSorter) {
+        glGenBuffers(2, buffers);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[0]);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, keys.size() * sizeof(uint64_t), NULL, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[1]);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, indices.size() * sizeof(uint32_t), NULL, GL_DYNAMIC_DRAW);
+    }
+
+    Result result = { gpuSorter ? "sort_gpu" : "sort_cpu", count, 0.0, 0.0, 0.0, 0.0, 0, 0 };
+    std::vector<double> frameTimes;
+    for (int frame = 0; frame < frames + WARMUP_FRAMES; frame++) {
+        uint64_t varyingBits = 0;
+        for (size_t i = 0; i < keys.size(); i++) {
+            const Instance& instance = instances[i];
+            float depth = std::fmod((instance.offsetY + 0.9f) / 1.8f + frame * 0.001f, 1.0f);
+            keys[i] = drawsort::blendedSortKey(i % 8 == 0 ? 1 : 0, depth, (uint16_t)(instance.r * 4.0f), (uint16_t)(instance.g * 4.0f));
+            indices[i] = (uint32_t)i;
+            varyingBits |= keys[i] ^ keys[0];
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        if (gpuSorter) {
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[0]);
+            glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, keys.size() * sizeof(uint64_t), keys.data());
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[1]);
+            glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, indices.size() * sizeof(uint32_t), indices.data());
+            glFinish();
+            start = std::chrono::steady_clock::now();
+            gpuSorter->sort(buffers[0], buffers[1], (GLuint)count, varyingBits);
+            glFinish();
+        }
+        else {
+            sorter.sort(keys, indices);
+        }
+        double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if (frame >= WARMUP_FRAMES) {
+            frameTimes.push_back(milliseconds);
+        }
+    }
+
+    if (gpuSorter) {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[0]);
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, keys.size() * sizeof(uint64_t), keys.data());
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        glDeleteBuffers(2, buffers);
+    }
+    if (!std::is_sorted(keys.begin(), keys.end())) {
+        std::cerr << result.strategy << " x" << count << " didn't sort the keys" << std::endl;
+    }
+
+    result.bytesUploaded = gpuSorter ? count * (sizeof(uint64_t) + sizeof(uint32_t)) : 0;
+    summarise(result, frameTimes);
+    return result;
+}
+
+//One result per line so the baseline can be read back without a JSON library
+std::string resultToJson(const Result& result) {
+    std::ostringstream json;
+    json << "{\"strategy\": \"" << result.strategy << "\", \"instances\": " << result.instances
+        << ", \"p50_ms\": " << result.p50 << ", \"p90_ms\": " << result.p90
+        << ", \"p99_ms\": " << result.p99 << ", \"max_ms\": " << result.max
+        << ", \"draw_calls\": " << result.drawCalls << ", \"bytes_uploaded\": " << result.bytesUploaded << ", \"state_changes\": " << result.stateChanges << "}";
+    return json.str();
+}
+
+//Pulls "key": value out of one of the lines written by resultToJson. Strings run to the closing
+//quote (renderer names have commas in them), numbers to the next comma or brace
+bool jsonField(const std::string& line, const std::string& key, std::string& value) {
+    size_t start = line.find("\"" + key + "\":");
+    if (start == std::string::npos) {
+        return false;
+    }
+    start = line.find_first_not_of(' ', start + key.size() + 3);
+    if (start == std::string::npos) {
+        return false;
+    }
+    size_t end = line[start] == '"' ? line.find('"', ++start) : line.find_first_of(",}", start);
+    value = line.substr(start, end == std::string::npos ? std::string::npos : end - start);
+    return true;
+}
+
+//Reads the renderer and results back out of a file written with --out, false if it couldn't be opened
+bool readBaseline(const std::string& path, std::string& renderer, std::vector<Result>& baseline) {
+    std::ifstream file(path);
+    if (!file) {
+        return false;
+    }
+    std::string line;
+    while (std::getline(file, line)) {
+        std::string strategy, instances, p50, p99;
+        if (jsonField(line, "strategy", strategy) && jsonField(line, "instances", instances)
+            && jsonField(line, "p50_ms", p50) && jsonField(line, "p99_ms", p99)) {
+            Result result = { strategy, std::atoll(instances.c_str()), std::atof(p50.c_str()), 0.0, std::atof(p99.c_str()), 0.0, 0, 0 };
+            baseline.push_back(result);
+        }
+        else {
+            jsonField(line, "renderer", renderer);
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    int frames = DEFAULT_FRAMES;
+    int repeats = DEFAULT_REPEATS;
+    long long maxInstances = DEFAULT_MAX_INSTANCES;
+    long long perObjectMax = DEFAULT_PER_OBJECT_MAX;
+    double thresholdP50 = DEFAULT_THRESHOLD_P50;
+    double thresholdP99 = DEFAULT_THRESHOLD_P99;
+    double minDeltaMs = DEFAULT_MIN_DELTA_MS;
+    std::string outPath, baselinePath;
+
+    for (int i = 1; i < argc; i += 2) {
+        std::string option = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << "Option " << option << " needs a value" << std::endl;
+            return -3;
+        }
+        const char* value = argv[i + 1];
+        if (option == "--frames") frames = std::max(1, std::atoi(value));
+        else if (option == "--repeats") repeats = std::max(1, std::atoi(value));
+        else if (option == "--max-instances") maxInstances = std::atoll(value);
+        else if (option == "--per-object-max") perObjectMax = std::atoll(value);
+        else if (option == "--threshold-p50") thresholdP50 = std::atof(value);
+        else if (option == "--threshold-p99") thresholdP99 = std::atof(value);
+        else if (option == "--min-delta-ms") minDeltaMs = std::atof(value);
+        else if (option == "--out") outPath = value;
+        else if (option == "--baseline") baselinePath = value;
+        else {
+            std::cerr << "Unknown option " << option << std::endl;
+            return -3;
+        }
+    }
+
+    //Read the baseline before spending minutes on the benchmark, a gate with nothing to compare against must not pass
+    std::string baselineRenderer;
+    std::vector<Result> baseline;
+    if (!baselinePath.empty()) {
+        if (!readBaseline(baselinePath, baselineRenderer, baseline)) {
+            std::cerr << "Couldn't read baseline " << baselinePath << std::endl;
+            return -3;
+        }
+        if (baseline.empty()) {
+            std::cerr << "No results found in baseline " << baselinePath << std::endl;
+            return -3;
+        }
+    }
+
+    //Setting error callback function
+    glfwSetErrorCallback(&glfwError);
+
+    //Starts up glfw
+    if (!glfwInit()) {
+        return -1;
+    }
+
+    //4.3 is enough for glMultiDrawArraysIndirect and is what llvmpipe can give us
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+
+    GLFWwindow* window = glfwCreateWindow(WIDTH, HEIGHT, "triangle benchmark", NULL, NULL);
+    if (window == NULL) {
+        glfwTerminate();
+        return -2;
+    }
+    glfwMakeContextCurrent(window);
+
+    //Start up glew
+    GLenum err = glewInit();
+    if (err != GLEW_OK) {
+        std::cerr << "glewInit failed: " << glewGetErrorString(err) << std::endl;
+        glfwTerminate();
+        return -2;
+    }
+
+    //Timings from another renderer say nothing about this one
+    std::string renderer = (const char*)glGetString(GL_RENDERER);
+    if (!baselinePath.empty() && baselineRenderer != renderer) {
+        std::cerr << "Baseline " << baselinePath << " was made with renderer \"" << baselineRenderer
+            << "\", this is \"" << renderer << "\". Not comparing them" << std::endl;
+        glfwTerminate();
+        return -4;
+    }
+
+    //Vsync would just measure the monitor
+    glfwSwapInterval(0);
+
+    GLuint shaderProgram = createProgram(vertexShaderSource, fragmentShaderSource);
+    GLuint instancedProgram = createProgram(instancedVertexShaderSource, instancedFragmentShaderSource);
+    GLuint tintedProgram = createProgram(vertexShaderSource, tintedFragmentShaderSource);
+
+    //VAO for one draw per triangle
+    GLuint VAO, VBO;
+    glGenVertexArrays(1, &VAO);
+    glGenBuffers(1, &VBO);
+    glBindVertexArray(VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(triangleMesh.vertices), triangleMesh.vertices, GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+
+    //VAO for the squares in the ordered draw cases
+    GLuint squareVAO, squareVBO;
+    glGenVertexArrays(1, &squareVAO);
+    glGenBuffers(1, &squareVBO);
+    glBindVertexArray(squareVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, squareVBO);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(squareMesh.vertices), squareMesh.vertices, GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+
+    //VAO for the instanced and indirect strategies: same vertices plus two attributes that step once per instance
+    GLuint instanceVAO, instanceVBO, indirectBuffer;
+    glGenVertexArrays(1, &instanceVAO);
+    glGenBuffers(1, &instanceVBO);
+    glGenBuffers(1, &indirectBuffer);
+    glBindVertexArray(instanceVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(Instance), (void*)0);
+    glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(Instance), (void*)(4 * sizeof(float)));
+    glVertexAttribDivisor(1, 1);
+    glVertexAttribDivisor(2, 1);
+    glEnableVertexAttribArray(1);
+    glEnableVertexAttribArray(2);
+
+    glViewport(0, 0, WIDTH, HEIGHT);
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+
+    drawsort::RadixSorter sorter;
+    const GLuint orderedPrograms[2] = { shaderProgram, tintedProgram };
+    const GLuint orderedVAOs[2] = { VAO, squareVAO };
+    drawsort::GpuRadixSorter gpuSorter;
+    bool gpuSort = gpuSorter.init();
+    if (!gpuSort) {
+        std::cerr << "Compute shaders not available, skipping sort_gpu" << std::endl;
+    }
+
+    //The whole sweep runs --repeats times and every case keeps the median of its runs, so a slow patch
+    //on the machine during one round doesn't decide the result
+    std::vector<std::vector<Result>> rounds(repeats);
+    for (int round = 0; round < repeats; round++) {
+        std::vector<Result>& results = rounds[round];
+
+        //Sweep every strategy over 1, 10, 100, ... instances
+        for (int strategy = 0; strategy < STRATEGY_COUNT; strategy++) {
+            long long limit = strategy == PER_OBJECT ? std::min(maxInstances, perObjectMax) : maxInstances;
+            for (long long count = 1; count <= limit; count *= 10) {
+                Result result = runCase(window, (Strategy)strategy, count, frames,
+                    shaderProgram, instancedProgram, VAO, instanceVAO, instanceVBO, indirectBuffer);
+                std::cerr << resultToJson(result) << std::endl;
+                results.push_back(result);
+            }
+        }
+
+        //Same sweep for building the matrices: everything on, then translate only (where the generic path still does it all)
+        for (long long count = 1; count <= maxInstances; count *= 10) {
+            Result transformResults[4] = {
+                runTransformCase("transform_generic", count, frames, [](const Instance& instance, float* out) {
+                    glm::mat4x4 MVP = genericMVP(instance.offsetX, instance.offsetY, instance.theta, instance.scale);
+                    std::copy(&MVP[0][0], &MVP[0][0] + 16, out);
+                }),
+                runTransformCase("transform_pipeline", count, frames, [](const Instance& instance, float* out) {
+                    geometry::Mat4 MVP = geometry::TransformPipeline<true, true, true>::compose(instance.offsetX, instance.offsetY, instance.theta, instance.scale);
+                    std::copy(MVP.m, MVP.m + 16, out);
+                }),
+                runTransformCase("transform_generic_translate", count, frames, [](const Instance& instance, float* out) {
+                    glm::mat4x4 MVP = genericMVP(instance.offsetX, instance.offsetY, 0.0f, 1.0f);
+                    std::copy(&MVP[0][0], &MVP[0][0] + 16, out);
+                }),
+                runTransformCase("transform_pipeline_translate", count, frames, [](const Instance& instance, float* out) {
+                    geometry::Mat4 MVP = geometry::TransformPipeline<true, false, false>::compose(instance.offsetX, instance.offsetY, 0.0f, 1.0f);
+                    std::copy(MVP.m, MVP.m + 16, out);
+                })
+            };
+            for (const Result& result : transformResults) {
+                std::cerr << resultToJson(result) << std::endl;
+                results.push_back(result);
+            }
+        }
+
+        //Draws in instance order against sorted orders, one draw call each so same limit as per_object
+        for (long long count = 1; count <= std::min(maxInstances, perObjectMax); count *= 10) {
+            for (int drawOrder = 0; drawOrder < DRAW_ORDER_COUNT; drawOrder++) {
+                Result result = runOrderedCase(window, (DrawOrder)drawOrder, count, frames, orderedPrograms, orderedVAOs, sorter);
+                std::cerr << resultToJson(result) << std::endl;
+                results.push_back(result);
+            }
+        }
+
+        //Just the sort, up to the full instance count
+        for (long long count = 1; count <= maxInstances; count *= 10) {
+            Result result = runSortCase(count, frames, sorter, NULL);
+            std::cerr << resultToJson(result) << std::endl;
+            results.push_back(result);
+            if (gpuSort) {
+                result = runSortCase(count, frames, sorter, &gpuSorter);
+                std::cerr << resultToJson(result) << std::endl;
+                results.push_back(result);
+            }
+        }
+    }
+    std::vector<Result> results = medianOfRounds(rounds);
+    gpuSorter.destroy();
+
+    std::ostringstream json;
+    json << "{\n  \"renderer\": \"" << renderer << "\",\n  \"frames\": " << frames << ",\n  \"repeats\": " << repeats << ",\n  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        json << "    " << resultToJson(results[i]) << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    json << "  ]\n}\n";
+
+    if (outPath.empty()) {
+        std::cout << json.str();
+    }
+    else {
+        std::ofstream(outPath) << json.str();
+    }
+
+    //Compare against the baseline. Only the median gates, it has to be over both the relative threshold and
+    //the absolute floor. A slow p99 alone is usually one frame the OS took, so that's just a warning
+    int regressions = 0, missing = 0;
+    if (!baselinePath.empty()) {
+        for (const Result& result : results) {
+            auto base = std::find_if(baseline.begin(), baseline.end(), [&](const Result& candidate) {
+                return candidate.strategy == result.strategy && candidate.instances == result.instances;
+            });
+            if (base == baseline.end()) {
+                std::cerr << "NOT IN BASELINE " << result.strategy << " x" << result.instances << std::endl;
+                missing++;
+                continue;
+            }
+            bool slowP50 = result.p50 > base->p50 * (1.0 + thresholdP50) && result.p50 - base->p50 > minDeltaMs;
+            bool slowP99 = result.p99 > base->p99 * (1.0 + thresholdP99) && result.p99 - base->p99 > minDeltaMs;
+            if (slowP50 || slowP99) {
+                std::cerr << (slowP50 ? "REGRESSION " : "p99 warning ") << result.strategy << " x" << result.instances
+                    << ": p50 " << base->p50 << " -> " << result.p50 << " ms, p99 "
+                    << base->p99 << " -> " << result.p99 << " ms" << std::endl;
+                regressions += slowP50;
+            }
+        }
+        std::cerr << regressions << " regression(s) against " << baselinePath;
+        if (missing > 0) {
+            std::cerr << ", " << missing << " case(s) not in the baseline";
+        }
+        std::cerr << std::endl;
+    }
+
+    //Cleanup
+    glDeleteVertexArrays(1, &VAO);
+    glDeleteVertexArrays(1, &instanceVAO);
+    glDeleteVertexArrays(1, &squareVAO);
+    glDeleteBuffers(1, &VBO);
+    glDeleteBuffers(1, &squareVBO);
+    glDeleteBuffers(1, &instanceVBO);
+    glDeleteBuffers(1, &indirectBuffer);
+    glDeleteProgram(shaderProgram);
+    glDeleteProgram(instancedProgram);
+    glDeleteProgram(tintedProgram);
+
+    glfwDestroyWindow(window);
+    glfwTerminate();
+    return regressions > 0 ? 1 : 0;
+}
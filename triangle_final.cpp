@@ -76,6 +76,11 @@ int main()
 
     //Start up glew
     GLenum err = glewInit();
+    if (err != GLEW_OK) {
+        std::cout << "glewInit failed: " << glewGetErrorString(err) << std::endl;
+        glfwTerminate();
+        return -3;
+    }
 
     //Vertices of the triangle
     GLfloat vertices[]{
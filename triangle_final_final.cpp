@@ -6,11 +6,11 @@ Chistopher Puran 40006107
 */
 
 #include <iostream>
+#include <vector>
 #include "GL/glew.h"
 #include "GLFW/glfw3.h"
-#include "glm.hpp"
-#include "mat4x4.hpp"
-#include "ext/matrix_transform.hpp"
+#include "geometry.hpp"
+#include "gl_instrumentation.hpp"
 
 //Window dimensions
 #define HEIGHT 800
@@ -19,10 +19,48 @@ Chistopher Puran 40006107
 #define TRIANGLE_HEIGHT 0.1f
 #define TRIANGLE_WIDTH 0.1f
 
+//Vertices of the (equilateral) triangle, generated at compile time
+constexpr geometry::Mesh<3> triangleMesh = geometry::scaleMesh(geometry::regularPolygon<3>(geometry::UNIT_TRIANGLE_RADIUS), TRIANGLE_WIDTH, TRIANGLE_HEIGHT);
+
+//How far the top and bottom of the triangle are from its centre, for keeping it on screen
+constexpr float TRIANGLE_TOP = TRIANGLE_HEIGHT / geometry::SQRT3;
+constexpr float TRIANGLE_BOTTOM = TRIANGLE_HEIGHT / (2 * geometry::SQRT3);
+
 #define TRANSFORM_MOD 0.01f
 #define ANGLE_MOD 0.05f
 #define SCALE_MOD 0.05f
 
+//Headless mode hides the window and quits after HEADLESS_FRAMES frames, handy with LIBGL_ALWAYS_SOFTWARE=1
+#define HEADLESS 0
+#define HEADLESS_FRAMES 600
+
+//Overdraw diagnostic: draws a heatmap of how many fragments hit each pixel instead of the normal scene
+#define OVERDRAW_DEBUG 0
+#define OVERDRAW_REPORT_INTERVAL 60 //Frames between overdraw printouts
+#define OVERDRAW_HEAT_MAX 8.0f //Overdraw that shows up as full red
+
+//Idle mode: sleeps in glfwWaitEventsTimeout and only redraws when something on screen actually changes
+#define IDLE_MODE 0
+#define IDLE_ANIMATION_FPS 30 //How often the colour cycling may advance in idle mode, 0 stops it
+#define COLOUR_CYCLE_SPEED 3.0f //colourMod per second (0.05 per frame at 60 fps)
+
+//GPU particles: a trail thrown off the back of the triangle, simulated entirely with transform feedback.
+//Particles are emitted again as soon as they die so the trail never stops moving, which means idle mode draws every frame
+#define PARTICLES 0
+#define PARTICLE_COUNT 262144
+#define PARTICLE_LIFETIME 2.0f //Average seconds a particle lives before it's emitted again
+#define PARTICLE_SPEED 0.3f
+#define PARTICLE_REPORT_INTERVAL 120 //Frames between particle timing printouts
+
+//Dynamic resolution: the scene goes into an offscreen target sized to keep GPU time under the budget, then gets upscaled
+#define DYNAMIC_RESOLUTION 0
+#define FRAME_BUDGET_MS 4.0f
+#define MIN_RESOLUTION_SCALE 0.25f
+#define RESOLUTION_REPORT_INTERVAL 120 //Frames between resolution printouts
+
+//Builds with GL_INSTRUMENTATION defined as 1 record CPU/GPU timings of each frame and write them here on exit (see gl_instrumentation.hpp)
+#define TRACE_FILE "triangle_trace.json"
+
 //MVP is the passed model-view-position matrix for moving verticies around
 const char* vertexShaderSource = R"glsl(
     #version 330 core
@@ -47,6 +85,172 @@ const char* fragmentShaderSource = R"glsl(
     } 
 )glsl";
 
+//Overdraw pass: every fragment adds 1 to the float target through additive blending
+const char* overdrawFragmentShaderSource = R"glsl(
+    #version 330 core
+    out float Overdraw;
+
+    void main()
+    {
+        Overdraw = 1.0;
+    }
+)glsl";
+
+//Particle simulation, run with the rasterizer off and the outputs captured by transform feedback.
+//A particle with a negative age hasn't been born yet, when its age passes its lifetime it gets
+//emitted again from the back of the triangle heading away from where the tip is pointing
+const char* particleUpdateShaderSource = R"glsl(
+    #version 330 core
+    layout (location = 0) in vec2 position;
+    layout (location = 1) in vec2 velocity;
+    layout (location = 2) in vec2 ageLife;
+    out vec2 outPosition;
+    out vec2 outVelocity;
+    out vec2 outAgeLife;
+    uniform vec2 emitter;
+    uniform float theta;
+    uniform float emitterSize;
+    uniform float speed;
+    uniform float lifetime;
+    uniform float dt;
+    uniform float time;
+    uniform bool seed;
+
+    float hash(uint n) {
+        n = (n << 13u) ^ n;
+        n = n * (n * n * 15731u + 789221u) + 1376312589u;
+        return float(n & 0x7fffffffu) / float(0x7fffffff);
+    }
+
+    void main() {
+        uint id = uint(gl_VertexID);
+        vec2 pos = position;
+        vec2 vel = velocity;
+        float age = ageLife.x;
+        float life = ageLife.y;
+
+        //First frame: the buffers are uninitialised, stagger the births over one lifetime
+        if (seed) {
+            life = lifetime * (0.5 + hash(id * 2u));
+            age = -hash(id * 2u + 1u) * life;
+            pos = vec2(0.0);
+            vel = vec2(0.0);
+        }
+
+        float newAge = age + dt;
+        if (newAge >= life) {
+            newAge = mod(newAge, life);
+        }
+
+        if (newAge >= 0.0 && (age < 0.0 || newAge < age)) {
+            //Born or wrapped around this step, emit from the triangle's base
+            uint n = id * 747796405u + uint(time * 1000.0) * 2891336453u;
+            vec2 forward = vec2(sin(theta), cos(theta));
+            vec2 side = vec2(forward.y, -forward.x);
+            float spread = (hash(n) - 0.5) * 0.8;
+            vec2 direction = -forward * cos(spread) + side * sin(spread);
+            vel = direction * speed * (0.5 + hash(n + 1u));
+            pos = emitter - forward * emitterSize * 0.5 + side * (hash(n + 2u) - 0.5) * emitterSize + vel * newAge;
+        }
+        else if (newAge >= 0.0) {
+            vel *= 1.0 - 0.5 * dt;
+            pos += vel * dt;
+        }
+
+        outPosition = pos;
+        outVelocity = vel;
+        outAgeLife = vec2(newAge, life);
+    }
+)glsl";
+
+//Particles fade out over their life, unborn ones get pushed outside the clip volume
+const char* particleVertexShaderSource = R"glsl(
+    #version 330 core
+    layout (location = 0) in vec2 position;
+    layout (location = 2) in vec2 ageLife;
+    out float fade;
+
+    void main() {
+        fade = 1.0 - ageLife.x / ageLife.y;
+        gl_Position = ageLife.x < 0.0 ? vec4(2.0, 2.0, 2.0, 1.0) : vec4(position, 0.0, 1.0);
+    }
+)glsl";
+
+//Additively blended, so in the overdraw diagnostic every particle just counts as 1
+const char* particleFragmentShaderSource = R"glsl(
+    #version 330 core
+    in float fade;
+    out vec4 FragColour;
+    uniform vec4 vertexColour;
+    uniform bool countOverdraw;
+
+    void main()
+    {
+        FragColour = countOverdraw ? vec4(1.0) : vec4(vertexColour.rgb * fade * 0.5, 1.0);
+    }
+)glsl";
+
+//Fullscreen triangle made from gl_VertexID so the heatmap pass doesn't need a VBO
+const char* heatmapVertexShaderSource = R"glsl(
+    #version 330 core
+    out vec2 UV;
+
+    void main() {
+        UV = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+        gl_Position = vec4(UV * 2.0 - 1.0, 0.0, 1.0);
+    }
+)glsl";
+
+//Maps the overdraw count to black (none) then blue -> green -> red
+const char* heatmapFragmentShaderSource = R"glsl(
+    #version 330 core
+    in vec2 UV;
+    out vec4 FragColour;
+    uniform sampler2D overdraw;
+    uniform float heatMax;
+
+    void main()
+    {
+        float n = texture(overdraw, UV).r;
+        float t = clamp(n / heatMax, 0.0, 1.0);
+        vec3 heat = vec3(smoothstep(0.5, 1.0, t), 1.0 - abs(t * 2.0 - 1.0), 1.0 - smoothstep(0.0, 0.5, t));
+        FragColour = vec4(n > 0.0 ? heat : vec3(0.0), 1.0);
+    }
+)glsl";
+
+//Compiles and links a vertex + fragment shader pair, printing the info log if something goes wrong
+GLuint createProgram(const char* vertexSource, const char* fragmentSource) {
+    GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
+    glShaderSource(vertexShader, 1, &vertexSource, NULL);
+    glCompileShader(vertexShader);
+
+    GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+    glShaderSource(fragmentShader, 1, &fragmentSource, NULL);
+    glCompileShader(fragmentShader);
+
+    GLuint program = glCreateProgram();
+    glAttachShader(program, vertexShader);
+    glAttachShader(program, fragmentShader);
+    glLinkProgram(program);
+
+    GLint linked = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if (!linked) {
+        char log[1024];
+        glGetShaderInfoLog(vertexShader, sizeof(log), NULL, log);
+        std::cout << log;
+        glGetShaderInfoLog(fragmentShader, sizeof(log), NULL, log);
+        std::cout << log;
+        glGetProgramInfoLog(program, sizeof(log), NULL, log);
+        std::cout << log << std::endl;
+    }
+
+    //Now that the shaders have been linked their objects can be deleted
+    glDeleteShader(vertexShader);
+    glDeleteShader(fragmentShader);
+    return program;
+}
+
 //Function for closing the window when the escape key is pressed
 void processInput(GLFWwindow* window) {
     if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS) {
@@ -60,6 +264,21 @@ static void glfwError(int id, const char* description)
     std::cout << description << std::endl;
 }
 
+//Set by window events that need a repaint (first show, uncovered, resized...) and cleared after drawing
+static bool windowDirty = true;
+
+//Window refresh callback function
+static void windowRefresh(GLFWwindow* window)
+{
+    windowDirty = true;
+}
+
+//Framebuffer size callback function
+static void framebufferResized(GLFWwindow* window, int width, int height)
+{
+    windowDirty = true;
+}
+
 int main()
 {
     //Setting error callback function
@@ -70,11 +289,16 @@ int main()
         return -1;
     }
 
-    //Tell GLFW what version of OpenGL we're using
+    //Tell GLFW what version of OpenGL we're using (software GL like llvmpipe stops at 4.5)
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 6);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, HEADLESS ? 5 : 6);
     //Core profile means only modern functions are available
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    if (HEADLESS) {
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    }
+    //Debug contexts report a lot more through the debug callback
+    glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, GL_INSTRUMENTATION ? GLFW_TRUE : GLFW_FALSE);
 
     //Creating the window and creating the current context
     GLFWwindow* window = glfwCreateWindow(WIDTH, HEIGHT, "the triangle", NULL, NULL);
@@ -83,34 +307,20 @@ int main()
         return -2;
     }
     glfwMakeContextCurrent(window);
+    glfwSetWindowRefreshCallback(window, &windowRefresh);
+    glfwSetFramebufferSizeCallback(window, &framebufferResized);
 
     //Start up glew
     GLenum err = glewInit();
-
-    //Vertices of the (equilateral) triangle
-    GLfloat vertices[]{
-        (TRIANGLE_WIDTH / 2),   -(TRIANGLE_HEIGHT / (2*sqrt(3))),   0.0f, //bottom left
-        -(TRIANGLE_WIDTH / 2),  -(TRIANGLE_HEIGHT / (2*sqrt(3))),   0.0f, //bottom right
-        0.0f,                   (TRIANGLE_HEIGHT / (sqrt(3))),      0.0f //top
-    };
+    if (err != GLEW_OK) {
+        std::cout << "glewInit failed: " << glewGetErrorString(err) << std::endl;
+        glfwTerminate();
+        return -3;
+    }
+    PROFILE_INIT();
 
     //Setting up the shader program with the glsl code above
-    GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertexShader, 1, &vertexShaderSource, NULL);
-    glCompileShader(vertexShader);
-
-    GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragmentShader, 1, &fragmentShaderSource, NULL);
-    glCompileShader(fragmentShader);
-
-    GLuint shaderProgram = glCreateProgram();
-    glAttachShader(shaderProgram, vertexShader);
-    glAttachShader(shaderProgram, fragmentShader);
-    glLinkProgram(shaderProgram);
-
-    //Now that the shaders have been linked their objects can be deleted
-    glDeleteShader(vertexShader);
-    glDeleteShader(fragmentShader);
+    GLuint shaderProgram = createProgram(vertexShaderSource, fragmentShaderSource);
 
     //Vertex array object and vertex buffer object:
     //VBO stores vertex data
@@ -124,7 +334,7 @@ int main()
     glBindBuffer(GL_ARRAY_BUFFER, VBO);
 
     //Storing vertex data in the VBO
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(triangleMesh.vertices), triangleMesh.vertices, GL_STATIC_DRAW);
 
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
     glEnableVertexAttribArray(0);
@@ -137,6 +347,122 @@ int main()
     glClear(GL_COLOR_BUFFER_BIT);
     glfwSwapBuffers(window); //Important to swap buffers after a change so the window actually updates
 
+    //Overdraw diagnostic resources: a single channel float target the scene is counted into,
+    //a query per frame (two so we read last frame's result instead of stalling) and the heatmap shader
+    GLuint overdrawProgram = 0, heatmapProgram = 0;
+    GLuint overdrawTexture = 0, overdrawFBO = 0, heatmapVAO = 0;
+    GLuint overdrawQueries[2] = { 0, 0 };
+    std::vector<float> overdrawPixels;
+    unsigned long long overdrawFragments = 0, overdrawMaxFragments = 0;
+    int overdrawFrames = 0;
+    if (OVERDRAW_DEBUG) {
+        overdrawProgram = createProgram(vertexShaderSource, overdrawFragmentShaderSource);
+        heatmapProgram = createProgram(heatmapVertexShaderSource, heatmapFragmentShaderSource);
+
+        glGenTextures(1, &overdrawTexture);
+        glBindTexture(GL_TEXTURE_2D, overdrawTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, WIDTH, HEIGHT, 0, GL_RED, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+        glGenFramebuffers(1, &overdrawFBO);
+        glBindFramebuffer(GL_FRAMEBUFFER, overdrawFBO);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, overdrawTexture, 0);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            std::cout << "Overdraw framebuffer is incomplete" << std::endl;
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        glGenVertexArrays(1, &heatmapVAO);
+        glGenQueries(2, overdrawQueries);
+        overdrawPixels.resize(WIDTH * HEIGHT);
+    }
+
+    //Particle resources: two buffers that take turns being read and captured into. Each has a transform
+    //feedback object so glDrawTransformFeedback knows how many particles the last pass wrote
+    GLuint particleUpdateProgram = 0, particleRenderProgram = 0;
+    GLuint particleBuffers[2] = { 0, 0 }, particleVAOs[2] = { 0, 0 }, particleFeedback[2] = { 0, 0 };
+    //Queries for three frames, the simulation is heavy enough that the GPU is often still on the last one
+    GLuint particleTimers[3][2] = { { 0, 0 }, { 0, 0 }, { 0, 0 } }; //[frame % 3][simulate, render]
+    GLuint particleWritten[3] = { 0, 0, 0 };
+    int particleCurrent = 0;
+    bool particlesSeeded = false;
+    double particleTime = glfwGetTime();
+    double particleReportTime = particleTime;
+    int particleReportFrame = 0;
+    GLuint64 particleSimulateNs = 0, particleRenderNs = 0, particlesSimulated = 0;
+    int particleFrames = 0;
+    if (PARTICLES) {
+        //Vertex shader only, the captured outputs are all we want out of it
+        GLuint updateShader = glCreateShader(GL_VERTEX_SHADER);
+        glShaderSource(updateShader, 1, &particleUpdateShaderSource, NULL);
+        glCompileShader(updateShader);
+        particleUpdateProgram = glCreateProgram();
+        glAttachShader(particleUpdateProgram, updateShader);
+        const char* varyings[] = { "outPosition", "outVelocity", "outAgeLife" };
+        glTransformFeedbackVaryings(particleUpdateProgram, 3, varyings, GL_INTERLEAVED_ATTRIBS);
+        glLinkProgram(particleUpdateProgram);
+        GLint linked = GL_FALSE;
+        glGetProgramiv(particleUpdateProgram, GL_LINK_STATUS, &linked);
+        if (!linked) {
+            char log[1024];
+            glGetShaderInfoLog(updateShader, sizeof(log), NULL, log);
+            std::cout << log << std::endl;
+        }
+        glDeleteShader(updateShader);
+
+        particleRenderProgram = createProgram(particleVertexShaderSource, particleFragmentShaderSource);
+
+        //position, velocity, (age, lifetime)
+        glGenBuffers(2, particleBuffers);
+        glGenVertexArrays(2, particleVAOs);
+        glGenTransformFeedbacks(2, particleFeedback);
+        for (int i = 0; i < 2; i++) {
+            glBindVertexArray(particleVAOs[i]);
+            glBindBuffer(GL_ARRAY_BUFFER, particleBuffers[i]);
+            glBufferData(GL_ARRAY_BUFFER, PARTICLE_COUNT * 6 * sizeof(float), NULL, GL_DYNAMIC_COPY);
+            glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
+            glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(2 * sizeof(float)));
+            glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(4 * sizeof(float)));
+            glEnableVertexAttribArray(0);
+            glEnableVertexAttribArray(1);
+            glEnableVertexAttribArray(2);
+
+            glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, particleFeedback[i]);
+            glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, particleBuffers[i]);
+        }
+        glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, 0);
+        glBindVertexArray(0);
+
+        glGenQueries(6, &particleTimers[0][0]);
+        glGenQueries(3, particleWritten);
+    }
+
+    //Dynamic resolution resources: a full size target we only use the bottom left corner of, so changing
+    //scale never reallocates, and GL_TIMESTAMP pairs (these can't clash with the particles' GL_TIME_ELAPSED queries)
+    GLuint sceneFBO = 0, sceneColour = 0;
+    GLuint resolutionTimers[2][2] = { { 0, 0 }, { 0, 0 } }; //[frame % 2][start, end]
+    float resolutionScales[2] = { 1.0f, 1.0f }; //Scale each timed frame was drawn at
+    float resolutionScale = 1.0f;
+    double resolutionGpuMs = 0.0;
+    int resolutionFrames = 0, resolutionWithinBudget = 0;
+    if (DYNAMIC_RESOLUTION && !OVERDRAW_DEBUG) {
+        glGenRenderbuffers(1, &sceneColour);
+        glBindRenderbuffer(GL_RENDERBUFFER, sceneColour);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, WIDTH, HEIGHT);
+
+        glGenFramebuffers(1, &sceneFBO);
+        glBindFramebuffer(GL_FRAMEBUFFER, sceneFBO);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, sceneColour);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            std::cout << "Scene framebuffer is incomplete" << std::endl;
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        glGenQueries(4, &resolutionTimers[0][0]);
+    }
+    int frame = 0;
+
     //Values for transformations
     float offsetX = 0.0f;
     float offsetY = 0.0f;
@@ -149,44 +475,61 @@ int main()
     float g = 1.0f;
     float b = 1.0f;
 
+    //Idle mode bookkeeping: what the last drawn frame showed, when the colour may next change and how much we skipped
+    float drawnOffsetX = 0.0f, drawnOffsetY = 0.0f, drawnTheta = 0.0f, drawnScale = 0.0f;
+    const double animationStep = 1.0 / (IDLE_ANIMATION_FPS > 0 ? IDLE_ANIMATION_FPS : 1);
+    double nextAnimationTime = 0.0;
+    double idleStartTime = glfwGetTime();
+    long long framesSkipped = 0;
+    bool drewLastWakeup = true;
+    const GLFWvidmode* idleMode = glfwGetVideoMode(glfwGetPrimaryMonitor());
+    const double refreshInterval = 1.0 / (idleMode && idleMode->refreshRate > 0 ? idleMode->refreshRate : 60);
+
     //Main render loop
-    while (!glfwWindowShouldClose(window)) {
+    while (!glfwWindowShouldClose(window) && !(HEADLESS && frame + framesSkipped >= HEADLESS_FRAMES)) {
         //Processing input (just for the escape key, all the other inputs are just handled in this loop)
         processInput(window);
 
-        //Sets refresh rate to 60 fps
-        glfwSwapInterval(1);
-
-        //Refreshing background colour
-        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
-        glClear(GL_COLOR_BUFFER_BIT);
-
-        //Transformation matrix
-        glm::mat4x4 rotation_matrix = glm::mat4x4(
-            glm::vec4(cos(theta),   -sin(theta),    0.0f, 0.0f),
-            glm::vec4(sin(theta),   cos(theta),     0.0f, 0.0f),
-            glm::vec4(0.0f,         0.0f,           1.0f, 0.0f),
-            glm::vec4(0.0f,         0.0f,           0.0f, 1.0f)
-        );
-
-        glm::mat4x4 scaling_matrix = glm::mat4x4(
-            glm::vec4(scale,    0.0f,   0.0f, 0.0f),
-            glm::vec4(0.0f,     scale,  0.0f, 0.0f),
-            glm::vec4(0.0f,     0.0f,   1.0f, 0.0f),
-            glm::vec4(0.0f,     0.0f,   0.0f, 1.0f)
-        );
-
-        glm::mat4x4 translation_matrix = glm::mat4x4(
-            glm::vec4(1.0f,     0.0f,       0.0f, 0.0f),
-            glm::vec4(0.0f,     1.0f,       0.0f, 0.0f),
-            glm::vec4(0.0f,     0.0f,       1.0f, 0.0f),
-            glm::vec4(offsetX,  offsetY,    0.0f, 1.0f)
-        );
-
-        // Combine matrices to make final MVP
-        glm::mat4x4 MVP = translation_matrix * rotation_matrix * scaling_matrix;
-
-        //Inputs
+        bool animated = false;
+        if (IDLE_MODE) {
+            //Held keys don't send events, so check the movement keys ourselves
+            const int movementKeys[] = { GLFW_KEY_W, GLFW_KEY_A, GLFW_KEY_S, GLFW_KEY_D, GLFW_KEY_Q, GLFW_KEY_E, GLFW_KEY_R, GLFW_KEY_F };
+            bool keyHeld = false;
+            for (int key : movementKeys) {
+                keyHeld = keyHeld || glfwGetKey(window, key) == GLFW_PRESS;
+            }
+
+            //Sleep until an event arrives or the next colour step is due. While something is changing (a key moving
+            //the triangle, or the trail, which is always moving) just poll and let the swap's vsync do the waiting.
+            //A held key that changed nothing last time is stuck against an edge or limit, so wait out a refresh
+            double now = glfwGetTime();
+            if (PARTICLES || (keyHeld && drewLastWakeup)) {
+                glfwPollEvents();
+            }
+            else if (keyHeld) {
+                glfwWaitEventsTimeout(refreshInterval);
+            }
+            else if (IDLE_ANIMATION_FPS > 0) {
+                glfwWaitEventsTimeout(nextAnimationTime > now ? nextAnimationTime - now : 0.0);
+            }
+            else {
+                glfwWaitEvents();
+            }
+
+            //Step the colour cycling at the throttled rate
+            now = glfwGetTime();
+            if (IDLE_ANIMATION_FPS > 0 && now >= nextAnimationTime) {
+                colourMod += COLOUR_CYCLE_SPEED * animationStep;
+                r = sin(colourMod) / 2 + 0.5;
+                g = cos(colourMod) / 2 + 0.5;
+                b = -cos(colourMod) / 2 + 0.5;
+                //Don't try to catch up on steps missed while the machine was busy
+                nextAnimationTime = nextAnimationTime + 2.0 * animationStep > now ? nextAnimationTime + animationStep : now + animationStep;
+                animated = true;
+            }
+        }
+
+        //Inputs (before idle mode's check, so a key press counts as something changing)
         if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS) {
             if ((TRIANGLE_WIDTH / 2) * scale + offsetX + TRANSFORM_MOD < 1) {
                 offsetX += TRANSFORM_MOD;
@@ -198,12 +541,12 @@ int main()
             }
         }
         if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS) {
-            if ((TRIANGLE_HEIGHT / sqrt(3)) * scale + offsetY + TRANSFORM_MOD < 1) {
+            if (TRIANGLE_TOP * scale + offsetY + TRANSFORM_MOD < 1) {
                 offsetY += TRANSFORM_MOD;
             }
         }
         if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS) {
-            if (-(TRIANGLE_HEIGHT / (2*sqrt(3))) * scale + offsetY - TRANSFORM_MOD > -1) {
+            if (-TRIANGLE_BOTTOM * scale + offsetY - TRANSFORM_MOD > -1) {
                 offsetY -= TRANSFORM_MOD;
             }
         }
@@ -220,34 +563,320 @@ int main()
             scale -= SCALE_MOD;
         }
 
+        if (IDLE_MODE) {
+            //Nothing moved, nothing animated (particles always are) and the window is fine, so the last frame is still correct
+            bool moved = offsetX != drawnOffsetX || offsetY != drawnOffsetY || theta != drawnTheta || scale != drawnScale;
+            if (!moved && !animated && !PARTICLES && !windowDirty) {
+                framesSkipped++;
+                drewLastWakeup = false;
+                continue;
+            }
+            drewLastWakeup = true;
+            drawnOffsetX = offsetX;
+            drawnOffsetY = offsetY;
+            drawnTheta = theta;
+            drawnScale = scale;
+            windowDirty = false;
+        }
+
+        //Sets refresh rate to 60 fps (headless runs uncapped)
+        glfwSwapInterval(HEADLESS ? 0 : 1);
+
+        //Refreshing background colour (dynamic resolution clears its own target and the upscale covers the whole window)
+        if (!DYNAMIC_RESOLUTION || OVERDRAW_DEBUG) {
+            PROFILE_GPU_BEGIN("clear");
+            glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+            glClear(GL_COLOR_BUFFER_BIT);
+            PROFILE_GPU_END();
+        }
+
+        PROFILE_CPU_BEGIN("update");
+
+        //Transformation matrix: translation * rotation * scaling, built directly
+        geometry::Mat4 MVP = geometry::TransformPipeline<true, true, true>::compose(offsetX, offsetY, theta, scale);
+
         //Passing stuff to shaders
         GLuint MatrixID = glGetUniformLocation(shaderProgram, "MVP");
         GLint ColourID = glGetUniformLocation(shaderProgram, "vertexColour");
         glUseProgram(shaderProgram);
-        glUniformMatrix4fv(MatrixID, 1, GL_FALSE, &MVP[0][0]);
+        glUniformMatrix4fv(MatrixID, 1, GL_FALSE, MVP.m);
         glUniform4f(ColourID, r, g, b, 1.0f);
 
-        //Cycling colours
-        r = sin(colourMod) / 2 + 0.5;
-        g = cos(colourMod) / 2 + 0.5;
-        b = -cos(colourMod) / 2 + 0.5;
-        colourMod += 0.05f;
+        //Cycling colours (idle mode steps them above instead)
+        if (!IDLE_MODE) {
+            r = sin(colourMod) / 2 + 0.5;
+            g = cos(colourMod) / 2 + 0.5;
+            b = -cos(colourMod) / 2 + 0.5;
+            colourMod += 0.05f;
+        }
+
+        PROFILE_CPU_END();
+        PROFILE_CPU_BEGIN("submit");
+
+        if (PARTICLES) {
+            double now = glfwGetTime();
+            float dt = (float)(now - particleTime);
+            dt = dt > 0.1f ? 0.1f : dt;
+            particleTime = now;
+
+            //Simulate: read the current buffer and capture the result into the other one
+            glBeginQuery(GL_TIME_ELAPSED, particleTimers[frame % 3][0]);
+            glEnable(GL_RASTERIZER_DISCARD);
+            glUseProgram(particleUpdateProgram);
+            glUniform2f(glGetUniformLocation(particleUpdateProgram, "emitter"), offsetX, offsetY);
+            glUniform1f(glGetUniformLocation(particleUpdateProgram, "theta"), theta);
+            glUniform1f(glGetUniformLocation(particleUpdateProgram, "emitterSize"), TRIANGLE_WIDTH * scale);
+            glUniform1f(glGetUniformLocation(particleUpdateProgram, "speed"), PARTICLE_SPEED);
+            glUniform1f(glGetUniformLocation(particleUpdateProgram, "lifetime"), PARTICLE_LIFETIME);
+            glUniform1f(glGetUniformLocation(particleUpdateProgram, "dt"), dt);
+            glUniform1f(glGetUniformLocation(particleUpdateProgram, "time"), (float)now);
+            glUniform1i(glGetUniformLocation(particleUpdateProgram, "seed"), !particlesSeeded);
+            glBindVertexArray(particleVAOs[particleCurrent]);
+            glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, particleFeedback[1 - particleCurrent]);
+            glBeginQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN, particleWritten[frame % 3]);
+            glBeginTransformFeedback(GL_POINTS);
+            if (particlesSeeded) {
+                glDrawTransformFeedback(GL_POINTS, particleFeedback[particleCurrent]);
+            }
+            else {
+                glDrawArrays(GL_POINTS, 0, PARTICLE_COUNT);
+                particlesSeeded = true;
+            }
+            glEndTransformFeedback();
+            glEndQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN);
+            glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, 0);
+            glDisable(GL_RASTERIZER_DISCARD);
+            glEndQuery(GL_TIME_ELAPSED);
+            particleCurrent = 1 - particleCurrent;
+
+            //Use the timings from two frames ago if the GPU has finished them, otherwise drop them rather than wait
+            GLint simulateReady = GL_FALSE, renderReady = GL_FALSE, writtenReady = GL_FALSE;
+            if (frame > 1) {
+                glGetQueryObjectiv(particleTimers[(frame + 1) % 3][0], GL_QUERY_RESULT_AVAILABLE, &simulateReady);
+                glGetQueryObjectiv(particleTimers[(frame + 1) % 3][1], GL_QUERY_RESULT_AVAILABLE, &renderReady);
+                glGetQueryObjectiv(particleWritten[(frame + 1) % 3], GL_QUERY_RESULT_AVAILABLE, &writtenReady);
+            }
+            if (simulateReady && renderReady && writtenReady) {
+                GLuint64 simulateNs = 0, renderNs = 0, written = 0;
+                glGetQueryObjectui64v(particleTimers[(frame + 1) % 3][0], GL_QUERY_RESULT, &simulateNs);
+                glGetQueryObjectui64v(particleTimers[(frame + 1) % 3][1], GL_QUERY_RESULT, &renderNs);
+                glGetQueryObjectui64v(particleWritten[(frame + 1) % 3], GL_QUERY_RESULT, &written);
+                particleSimulateNs += simulateNs;
+                particleRenderNs += renderNs;
+                particlesSimulated += written;
+                particleFrames++;
+            }
+            if (particleFrames == PARTICLE_REPORT_INTERVAL) {
+                //Dropped frames aren't in the total, so go from the average per measured frame and the frame rate
+                double framesPerSecond = (frame - particleReportFrame) / (now - particleReportTime);
+                std::cout << "Particles: " << (long long)(particlesSimulated / particleFrames * framesPerSecond) << " simulated/s ("
+                    << (long long)(PARTICLE_COUNT / PARTICLE_LIFETIME) << " emitted/s) | simulate "
+                    << particleSimulateNs / 1e6 / particleFrames << " ms, render "
+                    << particleRenderNs / 1e6 / particleFrames << " ms per frame" << std::endl;
+                particleSimulateNs = 0;
+                particleRenderNs = 0;
+                particlesSimulated = 0;
+                particleFrames = 0;
+                particleReportTime = now;
+                particleReportFrame = frame;
+            }
+        }
+
+        if (OVERDRAW_DEBUG) {
+            //Count every fragment the scene generates into the float target
+            glBindFramebuffer(GL_FRAMEBUFFER, overdrawFBO);
+            glClear(GL_COLOR_BUFFER_BIT);
+            glEnable(GL_BLEND);
+            glBlendFunc(GL_ONE, GL_ONE);
+            glBeginQuery(GL_SAMPLES_PASSED, overdrawQueries[frame % 2]);
+        }
+        else if (DYNAMIC_RESOLUTION) {
+            //Draw the scene into the corner of the offscreen target at the current scale
+            glQueryCounter(resolutionTimers[frame % 2][0], GL_TIMESTAMP);
+            resolutionScales[frame % 2] = resolutionScale;
+            glBindFramebuffer(GL_FRAMEBUFFER, sceneFBO);
+            glViewport(0, 0, (GLsizei)(WIDTH * resolutionScale), (GLsizei)(HEIGHT * resolutionScale));
+            //glClear ignores the viewport, scissor it so the clear shrinks with the scale too
+            glEnable(GL_SCISSOR_TEST);
+            glScissor(0, 0, (GLsizei)(WIDTH * resolutionScale), (GLsizei)(HEIGHT * resolutionScale));
+            glClear(GL_COLOR_BUFFER_BIT);
+            glDisable(GL_SCISSOR_TEST);
+        }
+
+        if (PARTICLES) {
+            //Draw the trail behind the triangle straight from what the simulation just captured
+            glBeginQuery(GL_TIME_ELAPSED, particleTimers[frame % 3][1]);
+            glEnable(GL_BLEND);
+            glBlendFunc(GL_ONE, GL_ONE);
+            glUseProgram(particleRenderProgram);
+            glUniform4f(glGetUniformLocation(particleRenderProgram, "vertexColour"), r, g, b, 1.0f);
+            glUniform1i(glGetUniformLocation(particleRenderProgram, "countOverdraw"), OVERDRAW_DEBUG);
+            glBindVertexArray(particleVAOs[particleCurrent]);
+            glDrawTransformFeedback(GL_POINTS, particleFeedback[particleCurrent]);
+            if (!OVERDRAW_DEBUG) {
+                glDisable(GL_BLEND);
+            }
+            glEndQuery(GL_TIME_ELAPSED);
+        }
 
         //Draw the triangle
+        PROFILE_GPU_BEGIN("triangle");
+        if (OVERDRAW_DEBUG) {
+            glUseProgram(overdrawProgram);
+            glUniformMatrix4fv(glGetUniformLocation(overdrawProgram, "MVP"), 1, GL_FALSE, MVP.m);
+        }
+        else {
+            glUseProgram(shaderProgram);
+        }
         glBindVertexArray(VAO);
         glDrawArrays(GL_TRIANGLES, 0, 3);
+        PROFILE_GPU_END();
+
+        if (OVERDRAW_DEBUG) {
+            PROFILE_GPU_SCOPE("overdraw");
+            glEndQuery(GL_SAMPLES_PASSED);
+            glDisable(GL_BLEND);
+
+            //Use last frame's count if the GPU has finished it, otherwise drop it rather than wait
+            GLint available = GL_FALSE;
+            if (frame > 0) {
+                glGetQueryObjectiv(overdrawQueries[(frame + 1) % 2], GL_QUERY_RESULT_AVAILABLE, &available);
+            }
+            if (available) {
+                GLuint64 fragments = 0;
+                glGetQueryObjectui64v(overdrawQueries[(frame + 1) % 2], GL_QUERY_RESULT, &fragments);
+                overdrawFragments += fragments;
+                overdrawMaxFragments = fragments > overdrawMaxFragments ? fragments : overdrawMaxFragments;
+                overdrawFrames++;
+            }
+
+            //Reading the heatmap back stalls, so only do it when it's time to print
+            if (overdrawFrames > 0 && overdrawFrames % OVERDRAW_REPORT_INTERVAL == 0) {
+                glReadPixels(0, 0, WIDTH, HEIGHT, GL_RED, GL_FLOAT, overdrawPixels.data());
+                double layers = 0.0;
+                float maxLayers = 0.0f;
+                int covered = 0;
+                for (float n : overdrawPixels) {
+                    if (n > 0.0f) {
+                        layers += n;
+                        covered++;
+                        maxLayers = n > maxLayers ? n : maxLayers;
+                    }
+                }
+                std::cout << "Overdraw: " << overdrawFragments / overdrawFrames << " fragments/frame avg, "
+                    << overdrawMaxFragments << " max | avg " << (covered > 0 ? layers / covered : 0.0)
+                    << "x max " << maxLayers << "x over " << 100.0 * covered / (WIDTH * HEIGHT)
+                    << "% of the screen" << std::endl;
+                overdrawFragments = 0;
+                overdrawMaxFragments = 0;
+                overdrawFrames = 0;
+            }
+
+            //Show the heatmap on screen
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            glUseProgram(heatmapProgram);
+            glUniform1f(glGetUniformLocation(heatmapProgram, "heatMax"), OVERDRAW_HEAT_MAX);
+            glBindTexture(GL_TEXTURE_2D, overdrawTexture);
+            glBindVertexArray(heatmapVAO);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+        }
+        else if (DYNAMIC_RESOLUTION) {
+            //The upscale writes the whole window whatever the scale, so it's left out of the measured time
+            //(the controller assumes the time it sees goes with the scene's pixel count)
+            glQueryCounter(resolutionTimers[frame % 2][1], GL_TIMESTAMP);
+
+            //Upscale into the window with bilinear filtering
+            PROFILE_GPU_SCOPE("upscale");
+            GLint sceneWidth = (GLint)(WIDTH * resolutionScale), sceneHeight = (GLint)(HEIGHT * resolutionScale);
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, sceneFBO);
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+            glBlitFramebuffer(0, 0, sceneWidth, sceneHeight, 0, 0, WIDTH, HEIGHT, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            glViewport(0, 0, WIDTH, HEIGHT);
+
+            //Use last frame's timing if it's ready, otherwise keep the current scale rather than stall
+            GLint available = GL_FALSE;
+            if (frame > 0) {
+                glGetQueryObjectiv(resolutionTimers[(frame + 1) % 2][1], GL_QUERY_RESULT_AVAILABLE, &available);
+            }
+            if (available) {
+                GLuint64 start = 0, end = 0;
+                glGetQueryObjectui64v(resolutionTimers[(frame + 1) % 2][0], GL_QUERY_RESULT, &start);
+                glGetQueryObjectui64v(resolutionTimers[(frame + 1) % 2][1], GL_QUERY_RESULT, &end);
+                double gpuMs = (end - start) / 1e6;
+
+                //GPU time goes roughly with pixel count, so scale each side by the square root of how far off we were.
+                //Aim a little under the budget and only move part of the way each frame so it doesn't oscillate
+                float measuredScale = resolutionScales[(frame + 1) % 2];
+                float target = measuredScale * (float)sqrt(0.9 * FRAME_BUDGET_MS / (gpuMs > 0.001 ? gpuMs : 0.001));
+                resolutionScale += (target - resolutionScale) * 0.25f;
+                resolutionScale = resolutionScale < MIN_RESOLUTION_SCALE ? MIN_RESOLUTION_SCALE : resolutionScale > 1.0f ? 1.0f : resolutionScale;
+
+                resolutionGpuMs += gpuMs;
+                resolutionWithinBudget += gpuMs <= FRAME_BUDGET_MS;
+                resolutionFrames++;
+            }
+            if (resolutionFrames == RESOLUTION_REPORT_INTERVAL) {
+                std::cout << "Dynamic resolution: scale " << resolutionScale << " (" << (int)(WIDTH * resolutionScale) << "x"
+                    << (int)(HEIGHT * resolutionScale) << "), GPU " << resolutionGpuMs / resolutionFrames << " ms avg for a "
+                    << FRAME_BUDGET_MS << " ms budget, " << 100 * resolutionWithinBudget / resolutionFrames
+                    << "% of frames within budget" << std::endl;
+                resolutionGpuMs = 0.0;
+                resolutionFrames = 0;
+                resolutionWithinBudget = 0;
+            }
+        }
+
+        PROFILE_CPU_END();
 
         //Swap front and back buffer
+        PROFILE_CPU_BEGIN("swap");
         glfwSwapBuffers(window);
+        PROFILE_CPU_END();
+        PROFILE_END_FRAME();
+        GL_CHECK();
 
         //Handles events
         glfwPollEvents();
+        frame++;
+    }
+
+    PROFILE_WRITE_TRACE(TRACE_FILE);
+
+    if (IDLE_MODE) {
+        //Only count what idle mode chose not to draw, frames lost to slow rendering aren't its doing
+        double seconds = glfwGetTime() - idleStartTime;
+        std::cout << "Idle mode: drew " << frame << " frames in " << seconds << "s, skipped " << framesSkipped
+            << " wakeups where nothing had changed" << std::endl;
     }
 
     //Cleanup
+    PROFILE_SHUTDOWN();
     glDeleteVertexArrays(1, &VAO);
     glDeleteBuffers(1, &VBO);
     glDeleteProgram(shaderProgram);
+    if (DYNAMIC_RESOLUTION && !OVERDRAW_DEBUG) {
+        glDeleteQueries(4, &resolutionTimers[0][0]);
+        glDeleteFramebuffers(1, &sceneFBO);
+        glDeleteRenderbuffers(1, &sceneColour);
+    }
+    if (PARTICLES) {
+        glDeleteQueries(6, &particleTimers[0][0]);
+        glDeleteQueries(3, particleWritten);
+        glDeleteTransformFeedbacks(2, particleFeedback);
+        glDeleteVertexArrays(2, particleVAOs);
+        glDeleteBuffers(2, particleBuffers);
+        glDeleteProgram(particleUpdateProgram);
+        glDeleteProgram(particleRenderProgram);
+    }
+    if (OVERDRAW_DEBUG) {
+        glDeleteQueries(2, overdrawQueries);
+        glDeleteVertexArrays(1, &heatmapVAO);
+        glDeleteFramebuffers(1, &overdrawFBO);
+        glDeleteTextures(1, &overdrawTexture);
+        glDeleteProgram(overdrawProgram);
+        glDeleteProgram(heatmapProgram);
+    }
 
     //Kill the window
     glfwDestroyWindow(window);
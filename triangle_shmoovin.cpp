@@ -75,6 +75,11 @@ int main()
 
     //Start up glew, must be done after making the current context or things break
     GLenum err = glewInit();
+    if (err != GLEW_OK) {
+        std::cout << "glewInit failed: " << glewGetErrorString(err) << std::endl;
+        glfwTerminate();
+        return -3;
+    }
 
     //Vertices of the triangle
     GLfloat vertices[]{